@@ -0,0 +1,381 @@
+/*
+ * Benchmark driver: times the public operations over a sweep of operand
+ * sizes, writes the results as CSV or JSON and compares them with a saved
+ * CSV baseline.
+ *
+ *   bench [--ops add,mul,...] [--min N] [--max N] [--step F] [--time S]
+ *         [--csv FILE] [--json FILE] [--baseline FILE] [--tolerance PCT]
+ *
+ * Sizes go from --min to --max digits (1 to 10^6 by default), multiplied by
+ * --step each time. Each point is repeated for about --time seconds and the
+ * best repetition is reported. With --baseline the exit status is 1 when
+ * some operation is more than --tolerance percent slower.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "bignum.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct bench_ctx {
+  bignum *a, *b, *c;
+  char *str;
+  int nbits;
+} bench_ctx;
+
+typedef struct bench_op {
+  const char *name;
+  void (*setup)(bench_ctx *ctx, int n);
+  void (*run)(bench_ctx *ctx);
+} bench_op;
+
+typedef struct bench_result {
+  const char *op;
+  int digits;
+  double ns_op;
+  double ns_digit;
+  double baseline;  /* ns_op of the baseline, 0 when missing. */
+} bench_result;
+
+static unsigned long long bench_seed = 0x9e3779b97f4a7c15ULL;
+
+static word
+bench_random_word(void)
+{
+  /* xorshift64 */
+  bench_seed ^= bench_seed << 13;
+  bench_seed ^= bench_seed >> 7;
+  bench_seed ^= bench_seed << 17;
+  return (word)bench_seed;
+}
+
+static void
+bench_random(bignum *a, int n, int sign)
+{
+  if (bignum_reserve(a, n) != 0) {
+    fprintf(stderr, "bench: out of memory\n");
+    exit(2);
+  }
+  for (int i = 0; i < n; i++) {
+    a->digit[i] = bench_random_word();
+  }
+  a->digit[n - 1] |= 1;
+  a->size = n;
+  a->sign = sign;
+}
+
+static double
+bench_now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Operations. a and b have n digits unless noted. */
+
+static void
+setup_binary(bench_ctx *ctx, int n)
+{
+  bench_random(ctx->a, n, BIGNUM_POSITIVE);
+  bench_random(ctx->b, n, BIGNUM_POSITIVE);
+}
+
+/* Two's complement operands for the bitwise operations. */
+static void
+setup_signed(bench_ctx *ctx, int n)
+{
+  bench_random(ctx->a, n, BIGNUM_NEGATIVE);
+  bench_random(ctx->b, n, BIGNUM_POSITIVE);
+}
+
+/* a has 2n digits, so the quotient has about n. */
+static void
+setup_div(bench_ctx *ctx, int n)
+{
+  bench_random(ctx->a, 2 * n, BIGNUM_POSITIVE);
+  bench_random(ctx->b, n, BIGNUM_POSITIVE);
+}
+
+static void
+setup_shift(bench_ctx *ctx, int n)
+{
+  bench_random(ctx->a, n, BIGNUM_POSITIVE);
+  ctx->nbits = n * BIGNUM_SHIFT / 2 + 5;
+}
+
+static void
+setup_from_str(bench_ctx *ctx, int n)
+{
+  bench_random(ctx->a, n, BIGNUM_POSITIVE);
+  ctx->str = bignum_to_str(ctx->a);
+}
+
+static void run_add(bench_ctx *ctx) { bignum_add(ctx->a, ctx->b, ctx->c); }
+static void run_sub(bench_ctx *ctx) { bignum_sub(ctx->a, ctx->b, ctx->c); }
+static void run_mul(bench_ctx *ctx) { bignum_mul(ctx->a, ctx->b, ctx->c); }
+static void run_sqr(bench_ctx *ctx) { bignum_sqr(ctx->a, ctx->c); }
+static void run_div(bench_ctx *ctx) { bignum_div(ctx->a, ctx->b, ctx->c); }
+static void run_mod(bench_ctx *ctx) { bignum_mod(ctx->a, ctx->b, ctx->c); }
+static void run_and(bench_ctx *ctx) { bignum_and(ctx->a, ctx->b, ctx->c); }
+static void run_or(bench_ctx *ctx) { bignum_or(ctx->a, ctx->b, ctx->c); }
+static void run_xor(bench_ctx *ctx) { bignum_xor(ctx->a, ctx->b, ctx->c); }
+static void run_neg(bench_ctx *ctx) { bignum_neg(ctx->a, ctx->c); }
+static void run_shl(bench_ctx *ctx) { bignum_shl(ctx->a, ctx->nbits, ctx->c); }
+static void run_shr(bench_ctx *ctx) { bignum_shr(ctx->a, ctx->nbits, ctx->c); }
+static void run_to_str(bench_ctx *ctx) { free(bignum_to_str(ctx->a)); }
+static void run_from_str(bench_ctx *ctx) { bignum_assign_str(ctx->c, ctx->str); }
+
+static const bench_op bench_ops[] = {
+  { "add", setup_binary, run_add },
+  { "sub", setup_binary, run_sub },
+  { "mul", setup_binary, run_mul },
+  { "sqr", setup_binary, run_sqr },
+  { "div", setup_div, run_div },
+  { "mod", setup_div, run_mod },
+  { "and", setup_signed, run_and },
+  { "or", setup_signed, run_or },
+  { "xor", setup_signed, run_xor },
+  { "neg", setup_signed, run_neg },
+  { "shl", setup_shift, run_shl },
+  { "shr", setup_shift, run_shr },
+  { "to_str", setup_binary, run_to_str },
+  { "from_str", setup_from_str, run_from_str },
+};
+
+#define BENCH_NOPS ((int)(sizeof(bench_ops) / sizeof(bench_ops[0])))
+
+/*
+ * Time one operation: repetitions of a batch of calls sized to take about a
+ * tenth of the time budget, returning the best ns per call.
+ */
+static double
+bench_time(const bench_op *op, bench_ctx *ctx, double budget)
+{
+  double best = -1, start, t;
+  long iters = 1;
+
+  /* Warm up and size the batch. */
+  for (;;) {
+    start = bench_now();
+    for (long i = 0; i < iters; i++) {
+      op->run(ctx);
+    }
+    t = bench_now() - start;
+    if (t >= budget / 10 || iters >= (1L << 30)) {
+      break;
+    }
+    iters = t > 0 ? (long)(iters * (budget / 10) / t) + 1 : iters * 10;
+  }
+
+  start = bench_now();
+  do {
+    double t0 = bench_now();
+    for (long i = 0; i < iters; i++) {
+      op->run(ctx);
+    }
+    t = (bench_now() - t0) / iters;
+    if (best < 0 || t < best) {
+      best = t;
+    }
+  } while (bench_now() - start < budget);
+
+  return best * 1e9;
+}
+
+static int
+bench_selected(const char *list, const char *name)
+{
+  size_t len = strlen(name);
+
+  if (list == NULL) {
+    return 1;
+  }
+  for (const char *p = list; *p != '\0'; ) {
+    const char *end = strchr(p, ',');
+    size_t n = end != NULL ? (size_t)(end - p) : strlen(p);
+
+    if (n == len && strncmp(p, name, n) == 0) {
+      return 1;
+    }
+    p += n + (end != NULL);
+  }
+  return 0;
+}
+
+/*
+ * Read the ns per operation of the rows of a CSV file written by --csv with
+ * the same digit size. Return 0 when op, digits has no row.
+ */
+static double
+bench_baseline(FILE *f, const char *op, int digits)
+{
+  char line[256], name[64];
+  int d, bits;
+  double ns;
+
+  if (f == NULL) {
+    return 0;
+  }
+  rewind(f);
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "%63[^,],%d,%d,%lf", name, &d, &bits, &ns) == 4 &&
+        strcmp(name, op) == 0 && d == digits && bits == BIGNUM_SHIFT) {
+      return ns;
+    }
+  }
+  return 0;
+}
+
+static void
+bench_usage(void)
+{
+  fprintf(stderr,
+          "usage: bench [--ops add,mul,...] [--min N] [--max N] [--step F] [--time S]\n"
+          "             [--csv FILE] [--json FILE] [--baseline FILE] [--tolerance PCT]\n");
+  exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *ops = NULL, *csv = NULL, *json = NULL, *baseline = NULL;
+  int min = 1, max = 1000000, nsizes = 0, nresults = 0, regressions = 0;
+  double step = 10, budget = 0.2, tolerance = 10;
+  bench_result *results;
+  bench_ctx ctx;
+  FILE *base = NULL, *out;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      bench_usage();
+    }
+    if (strcmp(argv[i], "--ops") == 0) {
+      ops = argv[++i];
+    } else if (strcmp(argv[i], "--min") == 0) {
+      min = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--max") == 0) {
+      max = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--step") == 0) {
+      step = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--time") == 0) {
+      budget = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--csv") == 0) {
+      csv = argv[++i];
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = argv[++i];
+    } else if (strcmp(argv[i], "--baseline") == 0) {
+      baseline = argv[++i];
+    } else if (strcmp(argv[i], "--tolerance") == 0) {
+      tolerance = atof(argv[++i]);
+    } else {
+      bench_usage();
+    }
+  }
+  if (min < 1 || max < min || step <= 1 || budget <= 0) {
+    bench_usage();
+  }
+
+  if (baseline != NULL && (base = fopen(baseline, "r")) == NULL) {
+    perror(baseline);
+    return 2;
+  }
+
+  for (double size = min; size < max * 1.0001; size *= step) {
+    nsizes++;
+  }
+  results = malloc(sizeof(bench_result) * BENCH_NOPS * nsizes);
+  if (results == NULL) {
+    fprintf(stderr, "bench: out of memory\n");
+    return 2;
+  }
+  ctx.a = bignum_new();
+  ctx.b = bignum_new();
+  ctx.c = bignum_new();
+  ctx.str = NULL;
+
+  printf("%-9s %9s %14s %12s%s\n", "op", "digits", "ns/op", "ns/digit",
+         base != NULL ? "   vs baseline" : "");
+
+  for (int k = 0; k < BENCH_NOPS; k++) {
+    const bench_op *op = &bench_ops[k];
+
+    if (!bench_selected(ops, op->name)) {
+      continue;
+    }
+
+    for (double size = min; size < max * 1.0001; size *= step) {
+      bench_result *r = &results[nresults++];
+      int n = (int)(size + 0.5);
+
+      op->setup(&ctx, n);
+      r->op = op->name;
+      r->digits = n;
+      r->ns_op = bench_time(op, &ctx, budget);
+      r->ns_digit = r->ns_op / n;
+      r->baseline = bench_baseline(base, op->name, n);
+      free(ctx.str);
+      ctx.str = NULL;
+
+      printf("%-9s %9d %14.1f %12.3f", r->op, r->digits, r->ns_op, r->ns_digit);
+      if (r->baseline > 0) {
+        double change = (r->ns_op / r->baseline - 1) * 100;
+
+        printf("   %+7.1f%%%s", change, change > tolerance ? "  REGRESSION" : "");
+        regressions += change > tolerance;
+      }
+      printf("\n");
+      fflush(stdout);
+    }
+  }
+
+  if (csv != NULL) {
+    if ((out = fopen(csv, "w")) == NULL) {
+      perror(csv);
+      return 2;
+    }
+    fprintf(out, "op,digits,digit_bits,ns_per_op,ns_per_digit\n");
+    for (int i = 0; i < nresults; i++) {
+      fprintf(out, "%s,%d,%d,%.1f,%.4f\n", results[i].op, results[i].digits, BIGNUM_SHIFT,
+              results[i].ns_op, results[i].ns_digit);
+    }
+    fclose(out);
+  }
+
+  if (json != NULL) {
+    if ((out = fopen(json, "w")) == NULL) {
+      perror(json);
+      return 2;
+    }
+    fprintf(out, "[\n");
+    for (int i = 0; i < nresults; i++) {
+      fprintf(out, "  {\"op\": \"%s\", \"digits\": %d, \"digit_bits\": %d, "
+              "\"ns_per_op\": %.1f, \"ns_per_digit\": %.4f", results[i].op, results[i].digits,
+              BIGNUM_SHIFT, results[i].ns_op, results[i].ns_digit);
+      if (results[i].baseline > 0) {
+        fprintf(out, ", \"baseline_ns_per_op\": %.1f", results[i].baseline);
+      }
+      fprintf(out, "}%s\n", i + 1 < nresults ? "," : "");
+    }
+    fprintf(out, "]\n");
+    fclose(out);
+  }
+
+  if (base != NULL) {
+    fclose(base);
+    printf("%d regression%s above %.0f%%\n", regressions, regressions == 1 ? "" : "s",
+           tolerance);
+  }
+
+  bignum_free(ctx.a);
+  bignum_free(ctx.b);
+  bignum_free(ctx.c);
+  free(results);
+
+  return regressions > 0 ? 1 : 0;
+}
@@ -9,954 +9,5133 @@
 #include <limits.h>
 #include <assert.h>
 
+#ifndef BIGNUM_NO_THREADS
+#  include <pthread.h>
+#endif
+
+/*
+ * Vector kernels for x86-64 with GCC or Clang, picked at run time from the
+ * CPU features. BIGNUM_NO_SIMD leaves only the portable code and
+ * BIGNUM_NO_AVX512 stops at AVX2.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(BIGNUM_NO_SIMD)
+#  define BIGNUM_X86_SIMD
+#  include <immintrin.h>
+#endif
+
+/*
+ * mulx/adcx/adox inline assembly for the single-digit multiplication
+ * kernels with 64-bit digits, also chosen at run time. BIGNUM_NO_ASM turns
+ * it off.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && BIGNUM_SHIFT == 64 && !defined(BIGNUM_NO_ASM)
+#  define BIGNUM_X86_ADX
+#endif
+
 static void bignum_resize(bignum *a, int sz);
-static void bignum_lshift(bignum *a, int shift);
 static bignum *bignum_normalize(bignum *a);
 static int bignum_is_zero(const bignum *a);
 static int bignum_bit_length(word x);
 static void bignum_set_sign(bignum *a, int sign);
 
 /* Arithmetic. */
-static bignum *bignum_add_a(const bignum *a, const bignum *b);
-static bignum *bignum_sub_a(const bignum *a, const bignum *b);
-static bignum *bignum_mul_a(const bignum *a, const bignum *b);
-static bignum *bignum_div_a(const bignum *a, const bignum *b);
-static bignum *bignum_div_a1(const bignum *a, const bignum *b);
-static bignum *bignum_div_a2(const bignum *a, const bignum *b);
-
-static bignum *bignum_bitwise_op(bignum *a, bignum *b, char op);
+static void bignum_add_a(const bignum *a, const bignum *b, bignum *c);
+static void bignum_sub_a(const bignum *a, const bignum *b, bignum *c);
+static void bignum_mul_a(const bignum *a, const bignum *b, bignum *c);
+static void bignum_div_a(const bignum *a, const bignum *b, bignum *c);
+static void bignum_div_a1(const bignum *a, const bignum *b, bignum *c);
+static void bignum_div_a2(const bignum *a, const bignum *b, bignum *c);
+static void bignum_divmod_a(const bignum *a, const bignum *b, bignum *q, bignum *r);
+static void bignum_init_u64(bignum *t, uint64_t b, int sign);
+
+static void bignum_bitwise_op(const bignum *a, const bignum *b, bignum *c, char op);
+
+/* Modular exponentiation. */
+static word bignum_mont_inverse(word m0);
+static int bignum_mont_scratch_size(const bignum_mont *ctx);
+static void bignum_mont_mul(const bignum_mont *ctx, word *r, const word *a, const word *b,
+                            word *t);
+static void bignum_mont_redc(const bignum_mont *ctx, word *r, word *t);
+static void bignum_mont_pow(const bignum_mont *ctx, word *r, const word *g, const bignum *e,
+                            word *t);
+static int bignum_pow_window(int bits);
+static void bignum_barrett_inverse(word *mu, const word *m, int n);
+static int bignum_barrett_scratch_size(int n);
+static void bignum_barrett_reduce(word *r, const word *x, int nx, const word *m, int n,
+                                  const word *mu, word *t);
+
+/* Digit array kernels. */
+static word bignum_add_n(word *r, const word *a, const word *b, int n);
+static word bignum_sub_n(word *r, const word *a, const word *b, int n);
+static void bignum_bitwise_n(word *r, const word *a, const word *b, int n, word mask_a,
+                             word mask_b, word mask_r, int is_and);
+static word bignum_add_1(word *r, const word *a, int n, word b);
+static word bignum_sub_1(word *r, const word *a, int n, word b);
+static word bignum_add_digits(word *r, const word *a, int na, const word *b, int nb);
+static word bignum_sub_digits(word *r, const word *a, int na, const word *b, int nb);
+static void bignum_add_into(word *r, int nr, const word *a, int na);
+static int bignum_cmp_digits(const word *a, int na, const word *b, int nb);
+static int bignum_sub_abs(word *r, const word *a, int na, const word *b, int nb);
+static word bignum_lshift_digits(word *r, const word *a, int n, int s);
+static word bignum_rshift_digits(word *r, const word *a, int n, int s);
+static word bignum_mul_1(word *r, const word *a, int n, word b);
+static word bignum_addmul_1(word *r, const word *a, int n, word b);
+static word bignum_inverse_1(word d);
+static inline word bignum_div_preinv(word *r, word u1, word u0, word d, word v);
+static word bignum_divrem_1(word *q, const word *a, int n, word d);
+static void bignum_divexact_by3(word *q, const word *a, int n);
+static word bignum_submul_1(word *r, const word *a, int n, word b);
+
+/* Division kernels. */
+static void bignum_divrem_digits(word *q, word *r, const word *a, int na, const word *d, int nd);
+static word bignum_div_qr(word *q, word *u, int nu, const word *v, int n);
+static word bignum_div_qr_basecase(word *q, word *u, int nu, const word *v, int n);
+static word bignum_div_qr_dc(word *q, word *u, int nu, const word *v, int n);
+static word bignum_div_qr_n(word *q, word *u, const word *v, int n);
+static void bignum_div_qr_top(word *q, word *u, const word *v, int n, int k);
+static word bignum_div_qr_newton(word *q, word *u, int nu, const word *v, int n);
+static void bignum_div_qr_preinv(word *q, word *w, int k, const word *v, int n, const word *x,
+                                 int h, int m);
+static void bignum_div_inverse(word *x, const word *v, int h);
+static int bignum_wrap_abs(word *r, int m, int n);
+
+/* Multiplication kernels. */
+static int bignum_mul_scratch_size(int n);
+static void bignum_mul_digits(word *r, const word *a, int na, const word *b, int nb,
+                              word *scratch);
+static void bignum_mul_n(word *r, const word *a, const word *b, int n, word *scratch);
+static void bignum_mul_basecase(word *r, const word *a, int na, const word *b, int nb);
+static void bignum_mul_karatsuba(word *r, const word *a, const word *b, int n,
+                                 word *scratch);
+static void bignum_mul_toom3(word *r, const word *a, const word *b, int n, word *scratch);
+static void bignum_toom3_interpolate(word *r, word *v1, word *vm1, word *v2, int n, int k,
+                                     int neg);
+static void bignum_sqr_n(word *r, const word *a, int n, word *scratch);
+static void bignum_sqr_basecase(word *r, const word *a, int n);
+static void bignum_sqr_karatsuba(word *r, const word *a, int n, word *scratch);
+static void bignum_sqr_toom3(word *r, const word *a, int n, word *scratch);
+static int bignum_mul_ntt_fits(int na, int nb);
+static void bignum_mul_ntt(word *r, const word *a, int na, const word *b, int nb);
+static int bignum_mul_wrap_size(int n);
+static void bignum_mul_wrap(word *r, const word *a, int na, const word *b, int nb, int m);
+
+/* Radix conversion. */
+static int bignum_str_size(int len);
+static int bignum_from_str_digits(word *r, const char *s, int len);
+static int bignum_from_str_basecase(word *r, const char *s, int len);
+static void bignum_to_str_digits(char *out, int len, const word *a, int na);
+static void bignum_to_str_basecase(char *out, int len, const word *a, int na);
+static const word *bignum_pow10(int i, int *n);
+
+/* Memory. */
+static void *bignum_mem_alloc(size_t n);
+static void *bignum_mem_realloc(void *p, size_t n);
+static void bignum_mem_free(void *p);
+
+#if defined(__GNUC__)
+#  define BIGNUM_THREAD_LOCAL __thread
+#else
+#  define BIGNUM_THREAD_LOCAL _Thread_local
+#endif
 
 /*
- * Create a new bignum object initialized to 0.
+ * Per-thread scratch arena. Temporaries are bump-allocated from a chain of
+ * blocks and released in LIFO order by restoring a mark saved on entry of
+ * the top-level call. The blocks are kept for later calls until
+ * bignum_thread_cleanup, so the steady state does not allocate.
  */
-bignum *
-bignum_new(void)
-{
-  bignum *a = malloc(sizeof(bignum));
-  if (a == NULL) {
-    return NULL;
-  }
-  a->sign = BIGNUM_POSITIVE;
-  a->size = 1;
-  a->digit = malloc(sizeof(word));
-  if (a->digit == NULL) {
-    free(a);
-    return NULL;
-  }
-  a->digit[0] = 0;
-  return a;
-}
+typedef struct bignum_arena_block {
+  struct bignum_arena_block *next;
+  size_t size;  /* Usable bytes. */
+  size_t used;
+} bignum_arena_block;
+
+typedef struct bignum_scratch_mark {
+  bignum_arena_block *block;
+  size_t used;
+} bignum_scratch_mark;
+
+static bignum_scratch_mark bignum_scratch_save(void);
+static void bignum_scratch_restore(bignum_scratch_mark mark);
+static void *bignum_scratch_alloc(size_t n);
+
+/* Threads. */
+static void bignum_parallel_for(int count, void (*fn)(void *arg, int i), void *arg);
+
+static void *(*bignum_alloc_func)(size_t) = malloc;
+static void *(*bignum_realloc_func)(void *, size_t) = realloc;
+static void (*bignum_free_func)(void *) = free;
+
+static BIGNUM_THREAD_LOCAL bignum_arena_block *bignum_arena_head;
+static BIGNUM_THREAD_LOCAL bignum_arena_block *bignum_arena_top;
+
+/* Cached powers of the decimal base for the radix conversion. */
+#define BIGNUM_POW10_MAX 32
+
+static BIGNUM_THREAD_LOCAL word *bignum_pow10_digit[BIGNUM_POW10_MAX];
+static BIGNUM_THREAD_LOCAL int bignum_pow10_size[BIGNUM_POW10_MAX];
+
+#ifdef BIGNUM_STATS
+static BIGNUM_THREAD_LOCAL bignum_stats bignum_stat;
+#  define BIGNUM_STAT(field, n) (bignum_stat.field += (unsigned long long)(n))
+#  define BIGNUM_STAT_CALL(op, n) \
+  (bignum_stat.calls[op]++, bignum_stat.digits[op] += (unsigned long long)(n))
+#else
+#  define BIGNUM_STAT(field, n) ((void)0)
+#  define BIGNUM_STAT_CALL(op, n) ((void)0)
+#endif
 
+/*
+ * Replace the functions used for all memory allocation, including the string
+ * returned by bignum_to_str. A NULL argument restores the standard library
+ * function. Should be called before any bignum object exists and before
+ * bignum_set_threads.
+ */
 void
-bignum_free(bignum *a)
+bignum_set_allocator(void *(*alloc_func)(size_t),
+                     void *(*realloc_func)(void *, size_t),
+                     void (*free_func)(void *))
 {
-  assert(a != NULL);
-  assert(a->digit != NULL);
-  free(a->digit);
-  free(a);
+  /* The arena of the calling thread came from the previous allocator. */
+  bignum_thread_cleanup();
+
+  bignum_alloc_func = alloc_func != NULL ? alloc_func : malloc;
+  bignum_realloc_func = realloc_func != NULL ? realloc_func : realloc;
+  bignum_free_func = free_func != NULL ? free_func : free;
 }
 
-static void
-bignum_resize(bignum *a, int sz)
+/*
+ * Release the scratch memory and the cached powers kept by the calling thread.
+ */
+void
+bignum_thread_cleanup(void)
 {
-  int size, i;
-  word *digit;
-
-  assert(a != NULL);
-  assert(a->digit != NULL);
-  assert(sz > 0);
-
-  size = a->size;
-  digit = a->digit;
+  bignum_arena_block *b = bignum_arena_head;
 
-  a->size = sz;
-  a->digit = malloc(sizeof(word) * sz);
-  if (a->digit == NULL) {
-    /* todo: Error. */
-    return;
+  for (int i = 0; i < BIGNUM_POW10_MAX; i++) {
+    bignum_mem_free(bignum_pow10_digit[i]);
+    bignum_pow10_digit[i] = NULL;
   }
 
-  for (i = 0; i < MIN(sz, size); i++) {
-    a->digit[i] = digit[i];
+  while (b != NULL) {
+    bignum_arena_block *next = b->next;
+    bignum_mem_free(b);
+    b = next;
   }
 
-  /* a is not normalize. */
-  for (; i < sz; i++) {
-    a->digit[i] = a->sign == BIGNUM_NEGATIVE_COMPLEMENT ? BIGNUM_MASK : 0;
-  }
+  bignum_arena_head = NULL;
+  bignum_arena_top = NULL;
+}
+
+/*
+ * Copy the counters of the calling thread.
+ */
+void
+bignum_stats_get(bignum_stats *s)
+{
+  assert(s != NULL);
 
-  free(digit);
+#ifdef BIGNUM_STATS
+  *s = bignum_stat;
+#else
+  memset(s, 0, sizeof(bignum_stats));
+#endif
 }
 
 void
-bignum_assign(bignum *a, const bignum *b)
+bignum_stats_reset(void)
 {
-  int size;
+#ifdef BIGNUM_STATS
+  memset(&bignum_stat, 0, sizeof(bignum_stats));
+#endif
+}
 
-  assert(a != NULL);
-  assert(b != NULL);
+#ifdef BIGNUM_STATS
 
-  a->sign = b->sign;
-  bignum_resize(a, b->size);
+/* s += end - start. All the fields are unsigned long long counters. */
+static void
+bignum_stats_add(bignum_stats *s, const bignum_stats *end, const bignum_stats *start)
+{
+  unsigned long long *p = (unsigned long long *)s;
+  const unsigned long long *e = (const unsigned long long *)end;
+  const unsigned long long *b = (const unsigned long long *)start;
 
-  size = b->size;
-  while (--size >= 0) {
-    a->digit[size] = b->digit[size];
+  for (size_t i = 0; i < sizeof(bignum_stats) / sizeof(unsigned long long); i++) {
+    p[i] += e[i] - b[i];
   }
 }
 
-void
-bignum_assign_int(bignum *a, int b)
+#endif
+
+static void *
+bignum_mem_alloc(size_t n)
 {
-  int sign;
-  int size;
-  unsigned abs_b;
+  BIGNUM_STAT(allocs, 1);
+  BIGNUM_STAT(alloc_bytes, n);
+  return bignum_alloc_func(n);
+}
 
-  assert(a != NULL);
+static void *
+bignum_mem_realloc(void *p, size_t n)
+{
+  BIGNUM_STAT(allocs, 1);
+  BIGNUM_STAT(alloc_bytes, n);
+  return bignum_realloc_func(p, n);
+}
 
-  if (b < 0) {
-    /* Because undefined behaviour when b is INT_MIN. */
-    sign = BIGNUM_NEGATIVE;
-    abs_b = 0U - (unsigned)b;
-  } else {
-    sign = BIGNUM_POSITIVE;
-    abs_b = (unsigned)b;
+static void
+bignum_mem_free(void *p)
+{
+  if (p != NULL) {
+    BIGNUM_STAT(frees, 1);
+    bignum_free_func(p);
   }
+}
 
-  a->sign = sign;
-
-#if BIGNUM_SHIFT == 16
-  size = 2;
-  bignum_resize(a, size);
-
-  a->size = size;
-  a->digit[0] = abs_b & BIGNUM_MASK;
-  a->digit[1] = (abs_b >> BIGNUM_SHIFT) & BIGNUM_MASK;
-#elif BIGNUM_SHIFT == 32
-  size = 1;
-  bignum_resize(a, size);
+#define BIGNUM_ARENA_ALIGN 16
+#define BIGNUM_ARENA_HEADER \
+  ((sizeof(bignum_arena_block) + BIGNUM_ARENA_ALIGN - 1) & ~(size_t)(BIGNUM_ARENA_ALIGN - 1))
+#define BIGNUM_ARENA_MIN_BLOCK 65536
 
-  a->size = size;
-  a->digit[0] = abs_b & BIGNUM_MASK;
-#endif
+static bignum_scratch_mark
+bignum_scratch_save(void)
+{
+  bignum_scratch_mark mark;
 
-  bignum_normalize(a);
+  mark.block = bignum_arena_top;
+  mark.used = bignum_arena_top != NULL ? bignum_arena_top->used : 0;
+  return mark;
 }
 
-void
-bignum_assign_str(bignum *a, char *b)
+/*
+ * Release everything allocated since the mark was saved.
+ */
+static void
+bignum_scratch_restore(bignum_scratch_mark mark)
 {
-  assert(a != NULL);
-  assert(b != NULL);
+  bignum_arena_block *b;
 
-  int size_a, size_b, sign, i, d;
+  b = mark.block != NULL ? mark.block->next : bignum_arena_head;
+  for (; b != NULL; b = b->next) {
+    b->used = 0;
+  }
 
-  if (*b == '-') {
-    sign = BIGNUM_NEGATIVE;
-    b++;
-  } else if (*b == '+') {
-    sign = BIGNUM_POSITIVE;
-    b++;
+  if (mark.block != NULL) {
+    mark.block->used = mark.used;
+    bignum_arena_top = mark.block;
   } else {
-    sign = BIGNUM_POSITIVE;
+    bignum_arena_top = bignum_arena_head;
   }
+}
 
-  size_b = strlen(b);
+/*
+ * Allocate n bytes of scratch, aligned to BIGNUM_ARENA_ALIGN. A spare block
+ * left by an earlier call is reused when it is large enough, otherwise the
+ * spares are replaced by a block at least twice as large as the current one.
+ * Aborts when the memory cannot be allocated, since the callers have no way
+ * to report it.
+ */
+static void *
+bignum_scratch_alloc(size_t n)
+{
+  bignum_arena_block *b = bignum_arena_top;
+  void *p;
 
-  /*
-   * Calculate the length the BIGNUM_BASE representation based on the following
-   * approximation:
-   * 2^x = 10^(size_b) => x = size_b*lg(10) <= size_b*3.33 <= size_b * 4
-   *
-   * size_a = (x / BIGNUM_BITS_IN_DITGIT) + 1
-   */
+  n = (n + BIGNUM_ARENA_ALIGN - 1) & ~(size_t)(BIGNUM_ARENA_ALIGN - 1);
+  BIGNUM_STAT(scratch_bytes, n);
 
-  bignum_assign_int(a, 0);
-  size_a = ((long long)size_b * 4) / BIGNUM_BITS_IN_DITGIT + 1;
-  bignum_resize(a, size_a);
+  if (b == NULL || b->size - b->used < n) {
+    bignum_arena_block *next = b != NULL ? b->next : bignum_arena_head;
 
-#define ADD(a, b) do {                                                          \
-    dword carry = (dword)(a)->digit[0] + (dword)(b);                            \
-    (a)->digit[0] = carry & BIGNUM_MASK;                                        \
-    carry >>= BIGNUM_SHIFT;                                                     \
-    for (int i = 1; i < (a)->size && carry > 0; i++) {                          \
-      carry += (a)->digit[i];                                                   \
-      (a)->digit[i] = carry & BIGNUM_MASK;                                      \
-      carry >>= BIGNUM_SHIFT;                                                   \
-    }                                                                           \
-    assert(carry == 0);                                                         \
-  } while (0)
-
-#define MULTIPLY(a, b) do {                                                     \
-    dword carry = 0;                                                            \
-    for (int i = 0; i < (a)->size; i++) {                                       \
-      carry += (dword)(a)->digit[i] * (dword)b;                                 \
-      (a)->digit[i] = carry & BIGNUM_MASK;                                      \
-      carry >>= BIGNUM_SHIFT;                                                   \
-    }                                                                           \
-    assert(carry == 0);                                                         \
-  } while (0)
+    if (next == NULL || next->size < n) {
+      size_t size = MAX(n, MAX((size_t)BIGNUM_ARENA_MIN_BLOCK, b != NULL ? 2 * b->size : 0));
 
-  d = 0;
-  for (i = 0; i < size_b % BIGNUM_DECIMAL_DIGITS; i++) {
-    d *= 10;
-    d += b[i] - '0';
-  }
+      /* The spares are empty, since b is the top block. */
+      while (next != NULL) {
+        bignum_arena_block *t = next->next;
+        bignum_mem_free(next);
+        next = t;
+      }
 
-  ADD(a, d);
+      next = bignum_mem_alloc(BIGNUM_ARENA_HEADER + size);
+      if (next == NULL) {
+        abort();
+      }
+      next->next = NULL;
+      next->size = size;
 
-  d = 0;
-  for (int j = 1; i < size_b; i++, j++) {
-    d *= 10;
-    d += b[i] - '0';
-    if (j == BIGNUM_DECIMAL_DIGITS) {
-      MULTIPLY(a, BIGNUM_DECIMAL_BASE);
-      ADD(a, d);
-      d = 0; j = 0;
+      if (b != NULL) {
+        b->next = next;
+      } else {
+        bignum_arena_head = next;
+      }
     }
-  }
 
-#undef ADD
-#undef MULTIPLY
+    next->used = 0;
+    bignum_arena_top = b = next;
+  }
 
-  bignum_set_sign(a, sign);
-  bignum_normalize(a);
+  p = (char *)b + BIGNUM_ARENA_HEADER + b->used;
+  b->used += n;
+  return p;
 }
 
 /*
- * Ignores overflows.
+ * Thread pool for large multiplications. A job is a loop of count
+ * independent iterations pushed on a shared stack. Idle workers claim
+ * iterations from the newest open job, and so does a thread waiting for its
+ * own job to finish, which keeps nested jobs from deadlocking. An iteration
+ * takes its scratch from the arena of the thread that runs it, and the
+ * counters of the iterations run by workers are handed back to the thread
+ * that submitted the job.
  */
-int
-bignum_to_int(bignum *a)
-{
-  assert(a != NULL);
+typedef struct bignum_job {
+  struct bignum_job *next;
+  void (*fn)(void *arg, int i);
+  void *arg;
+  int count;
+  int claimed;
+  int done;
+#ifdef BIGNUM_STATS
+  bignum_stats stats;  /* Counted by the workers, under the lock. */
+#endif
+} bignum_job;
 
-  int b = 0;
+#ifndef BIGNUM_NO_THREADS
 
-  b |= a->digit[0];
+static pthread_mutex_t bignum_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bignum_pool_cond = PTHREAD_COND_INITIALIZER;
+static bignum_job *bignum_pool_jobs;  /* Jobs with unclaimed iterations. */
+static pthread_t *bignum_pool_thread;
+static int bignum_pool_stop;
 
-#if BIGNUM_SHIFT == 16
-  if (a->size > 1) {
-    b |= a->digit[1] << BIGNUM_SHIFT;
-  }
 #endif
 
-  return a->sign == BIGNUM_POSITIVE ? (b) : -(b);
-}
+static int bignum_pool_size;  /* Worker threads, the caller not included. */
+
+#ifndef BIGNUM_NO_THREADS
 
 /*
- * Return the decimal representation of the number. Caller should free the memory
- * allocated by this function. Return NULL on error.
+ * Claim an iteration of job, which may be NULL, and run it. Called and
+ * returns with the lock held. Return 0 when there was nothing to run.
  */
-char *
-bignum_to_str(bignum *a)
+static int
+bignum_pool_run_one(bignum_job *job, int worker)
 {
-  int size_a, size_b, size_r, digits, i;
-  bignum *b;
-  char *r, *p;
-  dword carry = 0;
-
-  assert(a != NULL);
-
-  size_a = a->size;
-
-  /*
-   * Calculate the length of the decimal representation based on the following
-   * approximation:
-   *
-   *  2^(size * word_size) = 10^x => x = log(2) * (size * word_size) <=
-   *  <= 0.31 * (size * word_size) <= floor((31 * size * word_size) / 100) + 1.
-   */
-  digits = (31LL * (long long)size_a * BIGNUM_BITS_IN_DITGIT) / 100 + 1;
+  bignum_job **p;
+  int i;
+#ifdef BIGNUM_STATS
+  bignum_stats start;
+#endif
 
-  b = bignum_new();
-  if (b == NULL) {
-    return NULL;
+  if (job == NULL || job->claimed == job->count) {
+    return 0;
   }
-  bignum_resize(b, digits / BIGNUM_DECIMAL_DIGITS + 1);
-
-  /* Radix conversion according to TAOCP vol. 2 (3rd ed.), section 4.4, Method 1b. */
-  size_b = 0;
-  for (int i = size_a - 1; i >= 0; i--) {
-    carry = a->digit[i];
-
-    for (int j = 0; j < size_b; j++) {
-      carry = (dword)b->digit[j] << BIGNUM_SHIFT | carry;
-      b->digit[j] = carry % BIGNUM_DECIMAL_BASE;
-      carry /= BIGNUM_DECIMAL_BASE;
-    }
 
-    while (carry > 0) {
-      b->digit[size_b++] = carry % BIGNUM_DECIMAL_BASE;
-      carry /= BIGNUM_DECIMAL_BASE;
+  i = job->claimed++;
+  if (job->claimed == job->count) {
+    for (p = &bignum_pool_jobs; *p != job; p = &(*p)->next) {
     }
+    *p = job->next;
   }
-  b = bignum_normalize(b);
 
-  size_r = (long long)(b->size - 1) * BIGNUM_DECIMAL_DIGITS;
-
-  /* Count digits for the MSW. */
-  {
-    word d = b->digit[b->size - 1];
-    if (d == 0) {
-      size_r++;
-    }
-    while (d > 0) {
-      size_r++;
-      d /= 10;
-    }
-  }
+  pthread_mutex_unlock(&bignum_pool_lock);
+#ifdef BIGNUM_STATS
+  start = bignum_stat;
+#endif
+  job->fn(job->arg, i);
+  pthread_mutex_lock(&bignum_pool_lock);
 
-  if (a->sign == BIGNUM_NEGATIVE) {
-    size_r++;  /* +1 for the '-' character. */
+#ifdef BIGNUM_STATS
+  if (worker) {
+    bignum_stats_add(&job->stats, &bignum_stat, &start);
+    bignum_stat = start;
   }
+#else
+  (void)worker;
+#endif
 
-  size_r++;  /* +1 for the nul byte. */
-  r = malloc(size_r * sizeof(char));
-  if (r == NULL) {
-    bignum_free(b);
-    return NULL;
+  if (++job->done == job->count) {
+    pthread_cond_broadcast(&bignum_pool_cond);
   }
+  return 1;
+}
 
-  p = r + (size_r - 1);
-  *p-- = '\0';
+static void *
+bignum_pool_worker(void *unused)
+{
+  (void)unused;
 
-  for (i = 0; i < b->size - 1; i++) {
-    for (int j = 0; j < BIGNUM_DECIMAL_DIGITS; j++) {
-      *p-- = '0' + (char)(b->digit[i] % 10);
-      b->digit[i] /= 10;
+  pthread_mutex_lock(&bignum_pool_lock);
+  while (!bignum_pool_stop) {
+    if (!bignum_pool_run_one(bignum_pool_jobs, 1)) {
+      pthread_cond_wait(&bignum_pool_cond, &bignum_pool_lock);
     }
   }
+  pthread_mutex_unlock(&bignum_pool_lock);
 
-  if (b->digit[i] == 0) {
-    *p-- = '0';
-  }
+  bignum_thread_cleanup();
+  return NULL;
+}
 
-  while (b->digit[i] > 0) {
-    *p-- = '0' + (char)(b->digit[i] % 10);
-    b->digit[i] /= 10;
-  }
+#endif
 
-  if (a->sign == BIGNUM_NEGATIVE) {
-    *p-- = '-';
+#ifndef BIGNUM_NO_THREADS
+
+/* Stop and join all the workers. */
+static void
+bignum_pool_stop_all(void)
+{
+  if (bignum_pool_thread == NULL) {
+    return;
   }
 
-  assert(r == p + 1);
+  pthread_mutex_lock(&bignum_pool_lock);
+  bignum_pool_stop = 1;
+  pthread_cond_broadcast(&bignum_pool_cond);
+  pthread_mutex_unlock(&bignum_pool_lock);
 
-  bignum_free(b);
-  return r;
+  for (int i = 0; i < bignum_pool_size; i++) {
+    pthread_join(bignum_pool_thread[i], NULL);
+  }
+  bignum_mem_free(bignum_pool_thread);
+  bignum_pool_thread = NULL;
+  bignum_pool_size = 0;
+  bignum_pool_stop = 0;
 }
 
-void
-bignum_add(bignum *a, bignum *b, bignum *c)
+/* Start n workers, or none: those already started are stopped on failure. */
+static int
+bignum_pool_start(int n)
 {
-  bignum *r;
-
-  assert(a != NULL && b != NULL && c != NULL);
+  bignum_pool_thread = bignum_mem_alloc(sizeof(pthread_t) * n);
+  if (bignum_pool_thread == NULL) {
+    return -1;
+  }
 
-  if (a->sign == BIGNUM_NEGATIVE) {
-    if (b->sign == BIGNUM_NEGATIVE) {
-      r = bignum_add_a(a, b);
-      bignum_set_sign(r, BIGNUM_NEGATIVE);
-    } else {
-      r = bignum_sub_a(b, a);
-    }
-  } else {
-    if (b->sign == BIGNUM_NEGATIVE) {
-      r = bignum_sub_a(a, b);
-    } else {
-      r = bignum_add_a(a, b);
+  for (int i = 0; i < n; i++) {
+    if (pthread_create(&bignum_pool_thread[i], NULL, bignum_pool_worker, NULL) != 0) {
+      bignum_pool_stop_all();
+      return -1;
     }
+    bignum_pool_size++;
   }
-
-  bignum_assign(c, r);
-  bignum_free(r);
+  return 0;
 }
 
-void
-bignum_sub(bignum *a, bignum *b, bignum *c)
+#endif
+
+/*
+ * Start n - 1 worker threads, so that n threads take part in a large
+ * multiplication. n <= 1 stops the workers. On failure the previous workers
+ * are started again.
+ */
+int
+bignum_set_threads(int n)
 {
-  bignum *r;
+#ifndef BIGNUM_NO_THREADS
+  int prev = bignum_pool_size;
 
-  assert(a != NULL && b != NULL && c != NULL);
+  bignum_pool_stop_all();
 
-  if (a->sign == BIGNUM_NEGATIVE) {
-    if (b->sign == BIGNUM_NEGATIVE) {
-      r = bignum_sub_a(b, a);
-    } else {
-      r = bignum_add_a(a, b);
-      bignum_set_sign(r, BIGNUM_NEGATIVE);
-    }
-  } else {
-    if (b->sign == BIGNUM_NEGATIVE) {
-      r = bignum_add_a(a, b);
-    } else {
-      r = bignum_sub_a(a, b);
-    }
+  if (n <= 1) {
+    return 0;
   }
 
-  bignum_assign(c, r);
-  bignum_free(r);
+  if (bignum_pool_start(n - 1) != 0) {
+    if (prev > 0) {
+      bignum_pool_start(prev);
+    }
+    return -1;
+  }
+  return 0;
+#else
+  return n <= 1 ? 0 : -1;
+#endif
 }
 
-void
-bignum_mul(bignum *a, bignum *b, bignum *c)
+/*
+ * Run fn(arg, i) for i = 0, 1, ..., count - 1 on the pool and the calling
+ * thread, and return when all of them are done.
+ */
+static void
+bignum_parallel_for(int count, void (*fn)(void *arg, int i), void *arg)
 {
-  assert(a != NULL && b != NULL && c != NULL);
-
-  bignum *r;
+#ifndef BIGNUM_NO_THREADS
+  bignum_job job;
+
+  if (bignum_pool_size > 0 && count > 1) {
+    job.fn = fn;
+    job.arg = arg;
+    job.count = count;
+    job.claimed = 0;
+    job.done = 0;
+#ifdef BIGNUM_STATS
+    memset(&job.stats, 0, sizeof(bignum_stats));
+#endif
 
-  if (a->sign == BIGNUM_NEGATIVE) {
-    if (b->sign == BIGNUM_NEGATIVE) {
-      r = bignum_mul_a(a, b);
-    } else {
-      r = bignum_mul_a(a, b);
-      bignum_set_sign(r, BIGNUM_NEGATIVE);
-    }
-  } else {
-    if (b->sign == BIGNUM_NEGATIVE) {
-      r = bignum_mul_a(a, b);
-      bignum_set_sign(r, BIGNUM_NEGATIVE);
-    } else {
-      r = bignum_mul_a(a, b);
+    pthread_mutex_lock(&bignum_pool_lock);
+    job.next = bignum_pool_jobs;
+    bignum_pool_jobs = &job;
+    pthread_cond_broadcast(&bignum_pool_cond);
+
+    /* Only this job is helped with, so the wait cannot pick up an unrelated
+       long job such as a batch loop, and nesting follows the recursion of
+       fn alone. */
+    while (job.done < job.count) {
+      if (!bignum_pool_run_one(&job, 0)) {
+        pthread_cond_wait(&bignum_pool_cond, &bignum_pool_lock);
+      }
     }
+    pthread_mutex_unlock(&bignum_pool_lock);
+
+#ifdef BIGNUM_STATS
+    bignum_stats_add(&bignum_stat, &job.stats, &(bignum_stats){0});
+#endif
+    return;
   }
+#endif
 
-  bignum_assign(c, r);
-  bignum_free(r);
+  for (int i = 0; i < count; i++) {
+    fn(arg, i);
+  }
+}
+
+/*
+ * Shared state of bignum_batch_run. Each thread takes the next operation in
+ * order until none is left.
+ */
+typedef struct bignum_batch {
+  bignum_op *ops;
+  int *order;  /* Indices of ops, most expensive first. */
+  int n;
+  int next;
+  int done;
+  void (*progress)(void *arg, int done, int n);
+  void *arg;
+#ifndef BIGNUM_NO_THREADS
+  pthread_mutex_t lock;
+#endif
+} bignum_batch;
+
+typedef struct bignum_batch_cost {
+  double cost;
+  int index;
+} bignum_batch_cost;
+
+static int
+bignum_batch_cmp(const void *x, const void *y)
+{
+  const bignum_batch_cost *p = x, *q = y;
+
+  if (p->cost != q->cost) {
+    return p->cost > q->cost ? -1 : 1;
+  }
+  return p->index - q->index;
+}
+
+/* Schoolbook digit operations, enough to order the batch. */
+static double
+bignum_batch_estimate(const bignum_op *op)
+{
+  double na = op->a->size, nb = op->b->size;
+
+  switch (op->op) {
+    case BIGNUM_OP_MUL:
+      return na * nb;
+    case BIGNUM_OP_DIV:
+    case BIGNUM_OP_MOD:
+      return na >= nb ? (na - nb + 1) * nb : nb;
+    default:
+      return na + nb;
+  }
+}
+
+static void
+bignum_batch_task(void *arg, int unused)
+{
+  bignum_batch *batch = arg;
+  bignum_op *op;
+
+  (void)unused;
+
+  for (;;) {
+#ifndef BIGNUM_NO_THREADS
+    pthread_mutex_lock(&batch->lock);
+#endif
+    op = batch->next < batch->n ? &batch->ops[batch->order[batch->next++]] : NULL;
+#ifndef BIGNUM_NO_THREADS
+    pthread_mutex_unlock(&batch->lock);
+#endif
+    if (op == NULL) {
+      break;
+    }
+
+    switch (op->op) {
+      case BIGNUM_OP_ADD:
+        bignum_add(op->a, op->b, op->c);
+      break;
+      case BIGNUM_OP_SUB:
+        bignum_sub(op->a, op->b, op->c);
+      break;
+      case BIGNUM_OP_MUL:
+        bignum_mul(op->a, op->b, op->c);
+      break;
+      case BIGNUM_OP_DIV:
+        bignum_div(op->a, op->b, op->c);
+      break;
+      default:
+        bignum_mod(op->a, op->b, op->c);
+      break;
+    }
+
+#ifndef BIGNUM_NO_THREADS
+    pthread_mutex_lock(&batch->lock);
+#endif
+    batch->done++;
+    if (batch->progress != NULL) {
+      batch->progress(batch->arg, batch->done, batch->n);
+    }
+#ifndef BIGNUM_NO_THREADS
+    pthread_mutex_unlock(&batch->lock);
+#endif
+  }
 }
 
+/*
+ * Operations are handed out one at a time from a list sorted by estimated
+ * cost, so the large ones start early and the small ones fill the gaps at
+ * the end. Each thread computes in its own scratch arena, which the pool
+ * keeps from one batch to the next.
+ */
 void
-bignum_div(bignum *a, bignum *b, bignum *c)
+bignum_batch_run(bignum_op *ops, int n, int nthreads,
+                 void (*progress)(void *arg, int done, int n), void *arg)
 {
-  assert(a != NULL && b != NULL && c != NULL);
-  assert(bignum_is_zero(b) == 0);
+  bignum_scratch_mark mark;
+  bignum_batch_cost *cost;
+  bignum_batch batch;
+  int threads;
 
-  bignum *r;
+  assert(ops != NULL && n >= 0);
 
-  if (a->sign == BIGNUM_NEGATIVE) {
-    if (b->sign == BIGNUM_NEGATIVE) {
-      r = bignum_div_a(a, b);
-    } else {
-      r = bignum_div_a(a, b);
-      bignum_set_sign(r, BIGNUM_NEGATIVE);
+  for (int i = 0; i < n; i++) {
+    assert(ops[i].op >= BIGNUM_OP_ADD && ops[i].op <= BIGNUM_OP_MOD);
+    assert(ops[i].a != NULL && ops[i].b != NULL && ops[i].c != NULL);
+  }
+
+  if (n == 0) {
+    return;
+  }
+
+  mark = bignum_scratch_save();
+  cost = bignum_scratch_alloc(sizeof(bignum_batch_cost) * n);
+  batch.order = bignum_scratch_alloc(sizeof(int) * n);
+
+  for (int i = 0; i < n; i++) {
+    cost[i].cost = bignum_batch_estimate(&ops[i]);
+    cost[i].index = i;
+  }
+  qsort(cost, n, sizeof(bignum_batch_cost), bignum_batch_cmp);
+  for (int i = 0; i < n; i++) {
+    batch.order[i] = cost[i].index;
+  }
+
+  batch.ops = ops;
+  batch.n = n;
+  batch.next = 0;
+  batch.done = 0;
+  batch.progress = progress;
+  batch.arg = arg;
+
+  threads = bignum_pool_size + 1;
+  if (nthreads > 0 && nthreads < threads) {
+    threads = nthreads;
+  }
+  threads = MIN(threads, n);
+
+#ifndef BIGNUM_NO_THREADS
+  pthread_mutex_init(&batch.lock, NULL);
+#endif
+  bignum_parallel_for(threads, bignum_batch_task, &batch);
+#ifndef BIGNUM_NO_THREADS
+  pthread_mutex_destroy(&batch.lock);
+#endif
+
+  bignum_scratch_restore(mark);
+}
+
+/*
+ * Create a new bignum object initialized to 0.
+ */
+bignum *
+bignum_new(void)
+{
+  bignum *a = bignum_mem_alloc(sizeof(bignum));
+  if (a == NULL) {
+    return NULL;
+  }
+  bignum_init(a);
+  return a;
+}
+
+void
+bignum_free(bignum *a)
+{
+  assert(a != NULL);
+  bignum_clear(a);
+  bignum_mem_free(a);
+}
+
+/*
+ * Initialize a bignum object provided by the caller (e.g. on the stack) to 0.
+ * Small numbers are kept in the inline digits, so no memory is allocated.
+ */
+void
+bignum_init(bignum *a)
+{
+  assert(a != NULL);
+
+  a->sign = BIGNUM_POSITIVE;
+  a->size = 1;
+  a->alloc = BIGNUM_INLINE_DIGITS;
+  a->digit = a->inline_digit;
+  a->digit[0] = 0;
+}
+
+/*
+ * Release the memory owned by an object set up with bignum_init. The object
+ * is left equal to 0 and may be used again.
+ */
+void
+bignum_clear(bignum *a)
+{
+  assert(a != NULL);
+  assert(a->digit != NULL);
+
+  if (a->digit != a->inline_digit) {
+    bignum_mem_free(a->digit);
+  }
+  bignum_init(a);
+}
+
+/*
+ * Make room for at least n digits without changing the value. Return 0 on
+ * success and -1 if the memory cannot be allocated.
+ */
+int
+bignum_reserve(bignum *a, int n)
+{
+  word *digit;
+
+  assert(a != NULL);
+  assert(a->digit != NULL);
+  assert(n > 0);
+
+  if (n <= a->alloc) {
+    return 0;
+  }
+
+  if (a->digit == a->inline_digit) {
+    digit = bignum_mem_alloc(sizeof(word) * n);
+    if (digit == NULL) {
+      return -1;
     }
+    memcpy(digit, a->inline_digit, sizeof(word) * a->size);
   } else {
-    if (b->sign == BIGNUM_NEGATIVE) {
-      r = bignum_div_a(a, b);
-      bignum_set_sign(r, BIGNUM_NEGATIVE);
-    } else {
-      r = bignum_div_a(a, b);
+    digit = bignum_mem_realloc(a->digit, sizeof(word) * n);
+    if (digit == NULL) {
+      return -1;
     }
   }
 
-  bignum_assign(c, r);
-  bignum_free(r);
+  a->digit = digit;
+  a->alloc = n;
+  return 0;
 }
 
-static bignum *
-bignum_add_a(const bignum *a, const bignum *b)
+/*
+ * Release the digits allocated beyond the current size. A number that fits
+ * the inline digits moves back into them.
+ */
+void
+bignum_shrink_to_fit(bignum *a)
 {
-  int size_a, size_b, i;
-  dword carry = 0;
-  bignum *c;
+  word *digit;
 
-  size_a = a->size;
-  size_b = b->size;
+  assert(a != NULL);
+  assert(a->digit != NULL);
 
-  if (size_a < size_b) {
-    { const bignum *tmp = a; a = b; b = tmp; }
-    { int tmp = size_a; size_a = size_b; size_b = tmp; }
+  if (a->digit == a->inline_digit || a->alloc == a->size) {
+    return;
   }
 
-  c = bignum_new();
-  bignum_resize(c, size_a + 1);
+  if (a->size <= BIGNUM_INLINE_DIGITS) {
+    memcpy(a->inline_digit, a->digit, sizeof(word) * a->size);
+    bignum_mem_free(a->digit);
+    a->digit = a->inline_digit;
+    a->alloc = BIGNUM_INLINE_DIGITS;
+    return;
+  }
 
-  for (i = 0; i < size_b; i++) {
-    carry += (dword)a->digit[i] + (dword)b->digit[i];
-    c->digit[i] = carry & BIGNUM_MASK;
-    carry >>= BIGNUM_SHIFT;
+  digit = bignum_mem_realloc(a->digit, sizeof(word) * a->size);
+  if (digit == NULL) {
+    return;  /* Keep the larger buffer. */
   }
 
-  for (; i < size_a; i++) {
-    carry += (dword)a->digit[i];
-    c->digit[i] = carry & BIGNUM_MASK;
-    carry >>= BIGNUM_SHIFT;
+  a->digit = digit;
+  a->alloc = a->size;
+}
+
+/*
+ * Set the number of digits to sz. New digits are filled with zeros. The buffer
+ * only grows, by at least half of its size, so repeated resizing stays
+ * amortized O(1).
+ */
+static void
+bignum_resize(bignum *a, int sz)
+{
+  int i;
+
+  assert(a != NULL);
+  assert(a->digit != NULL);
+  assert(sz > 0);
+
+  BIGNUM_STAT(resizes, 1);
+  if (sz > a->alloc) {
+    BIGNUM_STAT(resize_copies, 1);
+    if (bignum_reserve(a, MAX(sz, a->alloc + a->alloc / 2)) != 0) {
+      /* todo: Error. */
+      return;
+    }
+  }
+
+  /* a is not normalize. */
+  for (i = a->size; i < sz; i++) {
+    a->digit[i] = 0;
   }
 
-  c->digit[i] = carry;
-  return bignum_normalize(c);
+  a->size = sz;
 }
 
-static bignum *
-bignum_sub_a(const bignum *a, const bignum *b)
+void
+bignum_assign(bignum *a, const bignum *b)
 {
-  int size_a, size_b, sign, i;
-  dword borrow = 0;
-  bignum *c;
+  assert(a != NULL);
+  assert(b != NULL);
 
-  sign = BIGNUM_POSITIVE;
-  size_a = a->size;
-  size_b = b->size;
+  if (a == b) {
+    return;
+  }
 
-  if (size_a < size_b) {
-    { const bignum *tmp = a; a = b; b = tmp; }
-    { int tmp = size_a; size_a = size_b; size_b = tmp; }
+  if (b->size > a->alloc && bignum_reserve(a, b->size) != 0) {
+    /* todo: Error. */
+    return;
+  }
+
+  a->sign = b->sign;
+  a->size = b->size;
+  memcpy(a->digit, b->digit, sizeof(word) * b->size);
+}
+
+void
+bignum_assign_int(bignum *a, int b)
+{
+  int sign;
+  int size;
+  unsigned abs_b;
+
+  assert(a != NULL);
+
+  if (b < 0) {
+    /* Because undefined behaviour when b is INT_MIN. */
     sign = BIGNUM_NEGATIVE;
-  } else if (size_a == size_b) {
-    i = size_a - 1;
+    abs_b = 0U - (unsigned)b;
+  } else {
+    sign = BIGNUM_POSITIVE;
+    abs_b = (unsigned)b;
+  }
+
+  a->sign = sign;
+
+#if BIGNUM_SHIFT == 16
+  size = 2;
+  bignum_resize(a, size);
+
+  a->size = size;
+  a->digit[0] = abs_b & BIGNUM_MASK;
+  a->digit[1] = (abs_b >> BIGNUM_SHIFT) & BIGNUM_MASK;
+#elif BIGNUM_SHIFT == 32 || BIGNUM_SHIFT == 64
+  size = 1;
+  bignum_resize(a, size);
+
+  a->size = size;
+  a->digit[0] = abs_b & BIGNUM_MASK;
+#endif
+
+  bignum_normalize(a);
+}
+
+void
+bignum_assign_str(bignum *a, const char *b)
+{
+  assert(b != NULL);
+
+  bignum_assign_strn(a, b, strlen(b));
+}
+
+/*
+ * Assign the decimal number in the first n characters of b, which does not
+ * need to be nul-terminated.
+ */
+void
+bignum_assign_strn(bignum *a, const char *b, size_t n)
+{
+  int size_a, size_b, sign;
+
+  assert(a != NULL);
+  assert(b != NULL);
+
+  sign = BIGNUM_POSITIVE;
+  if (n > 0 && (*b == '-' || *b == '+')) {
+    sign = *b == '-' ? BIGNUM_NEGATIVE : BIGNUM_POSITIVE;
+    b++;
+    n--;
+  }
+
+  assert(n <= INT_MAX);
+  size_b = (int)n;
+
+  if (size_b == 0) {
+    bignum_assign_int(a, 0);
+    return;
+  }
+
+  size_a = bignum_str_size(size_b);
+
+  a->sign = BIGNUM_POSITIVE;
+  bignum_resize(a, size_a);
+  a->size = bignum_from_str_digits(a->digit, b, size_b);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_FROM_STR, a->size);
+
+  bignum_set_sign(a, sign);
+}
+
+/*
+ * Upper bound of the number of digits of a decimal number with len characters:
+ * 2^x = 10^len => x = len*lg(10) <= len*3.33 <= len*4.
+ */
+static int
+bignum_str_size(int len)
+{
+  return (int)(((long long)len * 4) / BIGNUM_BITS_IN_DITGIT + 1);
+}
+
+/*
+ * Convert the decimal number s (len > 0 characters) to r, which has room for
+ * bignum_str_size(len) digits. Return the number of digits without leading
+ * zeros (at least 1).
+ *
+ * Divide and conquer: the low D*2^i characters, D = BIGNUM_DECIMAL_DIGITS, and
+ * the rest are converted recursively and combined as high * 10^(D*2^i) + low.
+ */
+static int
+bignum_from_str_digits(word *r, const char *s, int len)
+{
+  bignum_scratch_mark mark;
+  const word *p;
+  word *hi, *lo, *t, *scratch = NULL;
+  int i, low, np, nh, nl, n;
+
+  if ((len + BIGNUM_DECIMAL_DIGITS - 1) / BIGNUM_DECIMAL_DIGITS < BIGNUM_FROM_STR_DC_THRESHOLD ||
+      len <= 2 * BIGNUM_DECIMAL_DIGITS) {
+    return bignum_from_str_basecase(r, s, len);
+  }
+
+  /* The largest power with D*2^(i+1) <= len. */
+  i = 0;
+  while ((long long)BIGNUM_DECIMAL_DIGITS << (i + 2) <= len) {
+    i++;
+  }
+  low = BIGNUM_DECIMAL_DIGITS << i;
+
+  mark = bignum_scratch_save();
+  hi = bignum_scratch_alloc(sizeof(word) * bignum_str_size(len - low));
+  lo = bignum_scratch_alloc(sizeof(word) * bignum_str_size(low));
+  nh = bignum_from_str_digits(hi, s, len - low);
+  nl = bignum_from_str_digits(lo, s + len - low, low);
+
+  if (nh == 1 && hi[0] == 0) {
+    memcpy(r, lo, sizeof(word) * nl);
+    bignum_scratch_restore(mark);
+    return nl;
+  }
+
+  p = bignum_pow10(i, &np);
+
+  /* The product may have one more digit than the bound of r, before the
+     leading zero is stripped. */
+  t = bignum_scratch_alloc(sizeof(word) * (nh + np));
+  if (bignum_mul_scratch_size(MIN(nh, np)) > 0) {
+    scratch = bignum_scratch_alloc(sizeof(word) * bignum_mul_scratch_size(MIN(nh, np)));
+  }
+  if (nh >= np) {
+    bignum_mul_digits(t, hi, nh, p, np, scratch);
+  } else {
+    bignum_mul_digits(t, p, np, hi, nh, scratch);
+  }
+
+  n = nh + np;
+  bignum_add_into(t, n, lo, nl);
+  while (n > 1 && t[n - 1] == 0) {
+    n--;
+  }
+  assert(n <= bignum_str_size(len));
+  memcpy(r, t, sizeof(word) * n);
+
+  bignum_scratch_restore(mark);
+  return n;
+}
+
+/*
+ * bignum_from_str_digits for short strings. Horner's rule over chunks of
+ * BIGNUM_DECIMAL_DIGITS characters, touching only the digits in use.
+ */
+static int
+bignum_from_str_basecase(word *r, const char *s, int len)
+{
+  int n, i, k;
+  word d, carry;
+
+  k = len % BIGNUM_DECIMAL_DIGITS;
+  if (k == 0) {
+    k = BIGNUM_DECIMAL_DIGITS;
+  }
+
+  d = 0;
+  for (i = 0; i < k; i++) {
+    d = d * 10 + (word)(s[i] - '0');
+  }
+  r[0] = d;
+  n = 1;
+
+  while (i < len) {
+    d = 0;
+    for (k = 0; k < BIGNUM_DECIMAL_DIGITS; k++, i++) {
+      d = d * 10 + (word)(s[i] - '0');
+    }
+
+    carry = bignum_mul_1(r, r, n, BIGNUM_DECIMAL_BASE);
+    carry += bignum_add_1(r, r, n, d);
+    if (carry > 0) {
+      r[n++] = carry;
+    }
+  }
+
+  while (n > 1 && r[n - 1] == 0) {
+    n--;
+  }
+  return n;
+}
+
+/*
+ * Ignores overflows.
+ */
+int
+bignum_to_int(bignum *a)
+{
+  assert(a != NULL);
+
+  int b = 0;
+
+  b |= a->digit[0];
+
+#if BIGNUM_SHIFT == 16
+  if (a->size > 1) {
+    b |= a->digit[1] << BIGNUM_SHIFT;
+  }
+#endif
+
+  return a->sign == BIGNUM_POSITIVE ? (b) : -(b);
+}
+
+/*
+ * Return the decimal representation of the number. Caller should free the memory
+ * allocated by this function (with the free function of bignum_set_allocator).
+ * Return NULL on error.
+ */
+char *
+bignum_to_str(bignum *a)
+{
+  int size_a, size_r, digits;
+  bignum_scratch_mark mark;
+  char *r, *buf, *p;
+
+  assert(a != NULL);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_TO_STR, a->size);
+
+  size_a = a->size;
+
+  /*
+   * Calculate the length of the decimal representation based on the following
+   * approximation:
+   *
+   *  2^(size * word_size) = 10^x => x = log(2) * (size * word_size) <=
+   *  <= 0.31 * (size * word_size) <= floor((31 * size * word_size) / 100) + 1.
+   */
+  digits = (31LL * (long long)size_a * BIGNUM_BITS_IN_DITGIT) / 100 + 1;
+
+  mark = bignum_scratch_save();
+  buf = bignum_scratch_alloc(digits);
+  bignum_to_str_digits(buf, digits, a->digit, size_a);
+
+  /* Strip the padding. */
+  p = buf;
+  while (p < buf + digits - 1 && *p == '0') {
+    p++;
+  }
+
+  size_r = (int)(buf + digits - p);
+
+  if (a->sign == BIGNUM_NEGATIVE) {
+    size_r++;  /* +1 for the '-' character. */
+  }
+
+  size_r++;  /* +1 for the nul byte. */
+  r = bignum_mem_alloc(size_r * sizeof(char));
+  if (r == NULL) {
+    bignum_scratch_restore(mark);
+    return NULL;
+  }
+
+  if (a->sign == BIGNUM_NEGATIVE) {
+    r[0] = '-';
+  }
+  memcpy(r + (a->sign == BIGNUM_NEGATIVE), p, buf + digits - p);
+  r[size_r - 1] = '\0';
+
+  bignum_scratch_restore(mark);
+  return r;
+}
+
+/*
+ * Write exactly len decimal digits of a (na digits) to out, padded with
+ * leading zeros. a < 10^len.
+ *
+ * Divide and conquer: a is split by a cached power 10^(D*2^i), where D is
+ * BIGNUM_DECIMAL_DIGITS, into a high and a low part, which are converted
+ * recursively. The cost follows the division of the halves.
+ */
+static void
+bignum_to_str_digits(char *out, int len, const word *a, int na)
+{
+  bignum_scratch_mark mark;
+  const word *p;
+  word *q, *r;
+  int i, low, np;
+
+  while (na > 1 && a[na - 1] == 0) {
+    na--;
+  }
+
+  if (na < BIGNUM_TO_STR_DC_THRESHOLD || len <= 2 * BIGNUM_DECIMAL_DIGITS) {
+    bignum_to_str_basecase(out, len, a, na);
+    return;
+  }
+
+  /* The largest power with D*2^(i+1) <= len. */
+  i = 0;
+  while ((long long)BIGNUM_DECIMAL_DIGITS << (i + 2) <= len) {
+    i++;
+  }
+  low = BIGNUM_DECIMAL_DIGITS << i;
+  p = bignum_pow10(i, &np);
+
+  if (na < np) {
+    memset(out, '0', len - low);
+    bignum_to_str_digits(out + len - low, low, a, na);
+    return;
+  }
+
+  mark = bignum_scratch_save();
+  q = bignum_scratch_alloc(sizeof(word) * (na - np + 1));
+  r = bignum_scratch_alloc(sizeof(word) * np);
+
+  bignum_divrem_digits(q, r, a, na, p, np);
+  bignum_to_str_digits(out, len - low, q, na - np + 1);
+  bignum_to_str_digits(out + len - low, low, r, np);
+
+  bignum_scratch_restore(mark);
+}
+
+/*
+ * (u1 * BIGNUM_BASE + u0) / BIGNUM_DECIMAL_BASE with u1 < BIGNUM_DECIMAL_BASE.
+ * Return the quotient and store the remainder in r. Compilers turn the
+ * division of a dword by a constant into multiplications when dword is a
+ * machine type; for 64-bit digits 10^19 is already normalized and its inverse
+ * is a compile-time constant for bignum_div_preinv.
+ */
+#if BIGNUM_SHIFT == 64
+
+#define BIGNUM_DECIMAL_INV \
+  ((word)(((dword)(word)~BIGNUM_DECIMAL_BASE << BIGNUM_SHIFT | BIGNUM_MASK) / \
+          BIGNUM_DECIMAL_BASE))
+
+static inline word
+bignum_div_decimal(word *r, word u1, word u0)
+{
+  return bignum_div_preinv(r, u1, u0, BIGNUM_DECIMAL_BASE, BIGNUM_DECIMAL_INV);
+}
+
+#else
+
+static inline word
+bignum_div_decimal(word *r, word u1, word u0)
+{
+  dword u = (dword)u1 << BIGNUM_SHIFT | u0;
+
+  *r = (word)(u % BIGNUM_DECIMAL_BASE);
+  return (word)(u / BIGNUM_DECIMAL_BASE);
+}
+
+#endif
+
+/*
+ * bignum_to_str_digits for small numbers. Radix conversion according to
+ * TAOCP vol. 2 (3rd ed.), section 4.4, Method 1b.
+ */
+static void
+bignum_to_str_basecase(char *out, int len, const word *a, int na)
+{
+  bignum_scratch_mark mark;
+  word *b;
+  char *p;
+  int size_b;
+  word carry;
+
+  mark = bignum_scratch_save();
+  b = bignum_scratch_alloc(sizeof(word) * (len / BIGNUM_DECIMAL_DIGITS + 1));
+
+  size_b = 0;
+  for (int i = na - 1; i >= 0; i--) {
+    carry = a[i];
+
+    for (int j = 0; j < size_b; j++) {
+      carry = bignum_div_decimal(&b[j], b[j], carry);
+    }
+
+    while (carry > 0) {
+      b[size_b++] = carry % BIGNUM_DECIMAL_BASE;
+      carry /= BIGNUM_DECIMAL_BASE;
+    }
+  }
+
+  p = out + len;
+  for (int i = 0; i < size_b; i++) {
+    word d = b[i];
+    for (int j = 0; j < BIGNUM_DECIMAL_DIGITS && p > out; j++) {
+      *--p = '0' + (char)(d % 10);
+      d /= 10;
+    }
+    assert(p > out || d == 0);
+  }
+
+  while (p > out) {
+    *--p = '0';
+  }
+
+  bignum_scratch_restore(mark);
+}
+
+/*
+ * Return 10^(D*2^i), D = BIGNUM_DECIMAL_DIGITS, and its number of digits in
+ * n. The powers are computed by repeated squaring once per thread and kept
+ * until bignum_thread_cleanup.
+ */
+static const word *
+bignum_pow10(int i, int *n)
+{
+  assert(i >= 0 && i < BIGNUM_POW10_MAX);
+
+  if (bignum_pow10_digit[0] == NULL) {
+    bignum_pow10_digit[0] = bignum_mem_alloc(sizeof(word));
+    if (bignum_pow10_digit[0] == NULL) {
+      abort();
+    }
+    bignum_pow10_digit[0][0] = BIGNUM_DECIMAL_BASE;
+    bignum_pow10_size[0] = 1;
+  }
+
+  for (int k = 1; k <= i; k++) {
+    bignum_scratch_mark mark;
+    const word *prev = bignum_pow10_digit[k - 1];
+    int size = bignum_pow10_size[k - 1];
+    word *t, *scratch = NULL;
+
+    if (bignum_pow10_digit[k] != NULL) {
+      continue;
+    }
+
+    t = bignum_mem_alloc(sizeof(word) * 2 * size);
+    if (t == NULL) {
+      abort();
+    }
+
+    mark = bignum_scratch_save();
+    if (bignum_mul_scratch_size(size) > 0) {
+      scratch = bignum_scratch_alloc(sizeof(word) * bignum_mul_scratch_size(size));
+    }
+    bignum_mul_digits(t, prev, size, prev, size, scratch);
+    bignum_scratch_restore(mark);
+
+    size *= 2;
+    while (t[size - 1] == 0) {
+      size--;
+    }
+    bignum_pow10_digit[k] = t;
+    bignum_pow10_size[k] = size;
+  }
+
+  *n = bignum_pow10_size[i];
+  return bignum_pow10_digit[i];
+}
+
+/*
+ * The arithmetic and bitwise operations write the result straight into c,
+ * which may be the same object as a or b (e.g. bignum_add(a, b, a)).
+ */
+void
+bignum_add(bignum *a, bignum *b, bignum *c)
+{
+  assert(a != NULL && b != NULL && c != NULL);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_ADD, a->size + b->size);
+
+  if (a->sign == BIGNUM_NEGATIVE) {
+    if (b->sign == BIGNUM_NEGATIVE) {
+      bignum_add_a(a, b, c);
+      bignum_set_sign(c, BIGNUM_NEGATIVE);
+    } else {
+      bignum_sub_a(b, a, c);
+    }
+  } else {
+    if (b->sign == BIGNUM_NEGATIVE) {
+      bignum_sub_a(a, b, c);
+    } else {
+      bignum_add_a(a, b, c);
+    }
+  }
+}
+
+void
+bignum_sub(bignum *a, bignum *b, bignum *c)
+{
+  assert(a != NULL && b != NULL && c != NULL);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_SUB, a->size + b->size);
+
+  if (a->sign == BIGNUM_NEGATIVE) {
+    if (b->sign == BIGNUM_NEGATIVE) {
+      bignum_sub_a(b, a, c);
+    } else {
+      bignum_add_a(a, b, c);
+      bignum_set_sign(c, BIGNUM_NEGATIVE);
+    }
+  } else {
+    if (b->sign == BIGNUM_NEGATIVE) {
+      bignum_add_a(a, b, c);
+    } else {
+      bignum_sub_a(a, b, c);
+    }
+  }
+}
+
+void
+bignum_mul(bignum *a, bignum *b, bignum *c)
+{
+  assert(a != NULL && b != NULL && c != NULL);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_MUL, a->size + b->size);
+
+  if (a->sign == BIGNUM_NEGATIVE) {
+    if (b->sign == BIGNUM_NEGATIVE) {
+      bignum_mul_a(a, b, c);
+    } else {
+      bignum_mul_a(a, b, c);
+      bignum_set_sign(c, BIGNUM_NEGATIVE);
+    }
+  } else {
+    if (b->sign == BIGNUM_NEGATIVE) {
+      bignum_mul_a(a, b, c);
+      bignum_set_sign(c, BIGNUM_NEGATIVE);
+    } else {
+      bignum_mul_a(a, b, c);
+    }
+  }
+}
+
+void
+bignum_sqr(bignum *a, bignum *c)
+{
+  assert(a != NULL && c != NULL);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_SQR, a->size);
+
+  bignum_mul_a(a, a, c);
+}
+
+void
+bignum_div(bignum *a, bignum *b, bignum *c)
+{
+  assert(a != NULL && b != NULL && c != NULL);
+  assert(bignum_is_zero(b) == 0);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_DIV, a->size + b->size);
+
+  if (a->sign == BIGNUM_NEGATIVE) {
+    if (b->sign == BIGNUM_NEGATIVE) {
+      bignum_div_a(a, b, c);
+    } else {
+      bignum_div_a(a, b, c);
+      bignum_set_sign(c, BIGNUM_NEGATIVE);
+    }
+  } else {
+    if (b->sign == BIGNUM_NEGATIVE) {
+      bignum_div_a(a, b, c);
+      bignum_set_sign(c, BIGNUM_NEGATIVE);
+    } else {
+      bignum_div_a(a, b, c);
+    }
+  }
+}
+
+void
+bignum_divmod(bignum *a, bignum *b, bignum *q, bignum *r)
+{
+  int sign_a, sign_b;
+
+  assert(a != NULL && b != NULL && q != NULL && r != NULL);
+  assert(q != r);
+  assert(bignum_is_zero(b) == 0);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_DIV, a->size + b->size);
+
+  sign_a = a->sign;
+  sign_b = b->sign;
+
+  bignum_divmod_a(a, b, q, r);
+
+  bignum_set_sign(q, sign_a == sign_b ? BIGNUM_POSITIVE : BIGNUM_NEGATIVE);
+  bignum_set_sign(r, sign_a);
+}
+
+void
+bignum_mod(bignum *a, bignum *b, bignum *c)
+{
+  bignum tmp, *r;
+  int sign_a, sign_b;
+
+  assert(a != NULL && b != NULL && c != NULL);
+  assert(bignum_is_zero(b) == 0);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_MOD, a->size + b->size);
+
+  sign_a = a->sign;
+  sign_b = b->sign;
+
+  /* b is needed after the division to adjust the remainder. */
+  r = c;
+  if (c == b) {
+    bignum_init(&tmp);
+    r = &tmp;
+  }
+
+  bignum_divmod_a(a, b, NULL, r);
+
+  /* Truncated and floor remainders differ when the signs differ. */
+  if (sign_a != sign_b && bignum_is_zero(r) == 0) {
+    bignum_sub_a(b, r, r);
+  }
+  bignum_set_sign(r, sign_b);
+
+  if (r == &tmp) {
+    bignum_assign(c, &tmp);
+    bignum_clear(&tmp);
+  }
+}
+
+/*
+ * Single-digit operands. The value is held in the inline digits of a bignum
+ * on the stack, so nothing is allocated for it.
+ */
+void
+bignum_add_ui(bignum *a, uint64_t b, bignum *c)
+{
+  bignum t;
+
+  bignum_init_u64(&t, b, BIGNUM_POSITIVE);
+  bignum_add(a, &t, c);
+}
+
+void
+bignum_add_si(bignum *a, int64_t b, bignum *c)
+{
+  bignum t;
+
+  bignum_init_u64(&t, b < 0 ? 0 - (uint64_t)b : (uint64_t)b,
+                  b < 0 ? BIGNUM_NEGATIVE : BIGNUM_POSITIVE);
+  bignum_add(a, &t, c);
+}
+
+void
+bignum_sub_ui(bignum *a, uint64_t b, bignum *c)
+{
+  bignum t;
+
+  bignum_init_u64(&t, b, BIGNUM_POSITIVE);
+  bignum_sub(a, &t, c);
+}
+
+void
+bignum_sub_si(bignum *a, int64_t b, bignum *c)
+{
+  bignum t;
+
+  bignum_init_u64(&t, b < 0 ? 0 - (uint64_t)b : (uint64_t)b,
+                  b < 0 ? BIGNUM_NEGATIVE : BIGNUM_POSITIVE);
+  bignum_sub(a, &t, c);
+}
+
+/*
+ * A multiplier of one digit is applied in place. Wider ones (64-bit values
+ * with 16 or 32-bit digits) read a from the scratch arena when c is a.
+ */
+void
+bignum_mul_ui(bignum *a, uint64_t b, bignum *c)
+{
+  bignum_scratch_mark mark;
+  bignum t;
+  const word *digit;
+  int size, sign;
+
+  assert(a != NULL && c != NULL);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_MUL, a->size + 1);
+
+  bignum_init_u64(&t, b, BIGNUM_POSITIVE);
+  size = a->size;
+  sign = a->sign;
+
+  if (t.size == 1) {
+    bignum_resize(c, size + 1);
+    c->digit[size] = bignum_mul_1(c->digit, a->digit, size, t.digit[0]);
+  } else {
+    mark = bignum_scratch_save();
+    digit = a->digit;
+    if (c == a) {
+      word *copy = bignum_scratch_alloc(sizeof(word) * size);
+      memcpy(copy, a->digit, sizeof(word) * size);
+      digit = copy;
+    }
+    bignum_resize(c, size + t.size);
+    bignum_mul_basecase(c->digit, digit, size, t.digit, t.size);
+    bignum_scratch_restore(mark);
+  }
+
+  bignum_normalize(c);
+  bignum_set_sign(c, sign);
+}
+
+void
+bignum_mul_si(bignum *a, int64_t b, bignum *c)
+{
+  int sign;
+
+  assert(a != NULL && c != NULL);
+
+  sign = a->sign;
+  bignum_mul_ui(a, b < 0 ? 0 - (uint64_t)b : (uint64_t)b, c);
+  if (b < 0) {
+    bignum_set_sign(c, sign == BIGNUM_NEGATIVE ? BIGNUM_POSITIVE : BIGNUM_NEGATIVE);
+  }
+}
+
+/*
+ * Divisors of one digit take the linear bignum_divrem_1 path in place; wider
+ * ones go through bignum_divrem_digits.
+ */
+uint64_t
+bignum_divmod_ui(bignum *a, uint64_t b, bignum *q)
+{
+  bignum t;
+  word r[64 / BIGNUM_SHIFT];
+  uint64_t rem;
+  int size, sign;
+
+  assert(a != NULL && q != NULL);
+  assert(b != 0);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_DIV, a->size + 1);
+
+  bignum_init_u64(&t, b, BIGNUM_POSITIVE);
+  size = a->size;
+  sign = a->sign;
+
+  if (size < t.size) {
+    memcpy(r, a->digit, sizeof(word) * size);
+    memset(r + size, 0, sizeof(word) * (t.size - size));
+    bignum_assign_int(q, 0);
+  } else {
+    bignum_resize(q, size - t.size + 1);
+    if (t.size == 1) {
+      BIGNUM_STAT(div_1, 1);
+      r[0] = bignum_divrem_1(q->digit, a->digit, size, t.digit[0]);
+    } else {
+      bignum_divrem_digits(q->digit, r, a->digit, size, t.digit, t.size);
+    }
+    bignum_normalize(q);
+    bignum_set_sign(q, sign);
+  }
+
+#if BIGNUM_SHIFT == 64
+  rem = r[0];
+#else
+  rem = 0;
+  for (int i = t.size - 1; i >= 0; i--) {
+    rem = rem << BIGNUM_SHIFT | r[i];
+  }
+#endif
+  return rem;
+}
+
+int64_t
+bignum_divmod_si(bignum *a, int64_t b, bignum *q)
+{
+  uint64_t rem;
+  int sign;
+
+  assert(a != NULL && q != NULL);
+  assert(b != 0);
+
+  sign = a->sign;
+  rem = bignum_divmod_ui(a, b < 0 ? 0 - (uint64_t)b : (uint64_t)b, q);
+  if (b < 0) {
+    bignum_set_sign(q, q->sign == BIGNUM_NEGATIVE ? BIGNUM_POSITIVE : BIGNUM_NEGATIVE);
+  }
+
+  /* |rem| < |b| <= 2^63, so the negation fits. */
+  return sign == BIGNUM_NEGATIVE ? -(int64_t)rem : (int64_t)rem;
+}
+
+void
+bignum_shl(const bignum *a, int nbits, bignum *c)
+{
+  int size, w, s, sign;
+
+  assert(a != NULL && c != NULL);
+  assert(nbits >= 0);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_SHIFT, a->size);
+
+  size = a->size;
+  sign = a->sign;
+  w = nbits / BIGNUM_SHIFT;
+  s = nbits % BIGNUM_SHIFT;
+
+  if (c != a) {
+    c->sign = BIGNUM_POSITIVE;
+    bignum_resize(c, size + w + 1);
+    if (s > 0) {
+      c->digit[size + w] = bignum_lshift_digits(c->digit + w, a->digit, size, s);
+    } else {
+      memcpy(c->digit + w, a->digit, sizeof(word) * size);
+      c->digit[size + w] = 0;
+    }
+  } else {
+    /* Shift the bits in place, then move the digits up. */
+    bignum_resize(c, size + w + 1);
+    c->digit[size] = s > 0 ? bignum_lshift_digits(c->digit, c->digit, size, s) : 0;
+    if (w > 0) {
+      memmove(c->digit + w, c->digit, sizeof(word) * (size + 1));
+    }
+  }
+  memset(c->digit, 0, sizeof(word) * w);
+
+  bignum_normalize(c);
+  bignum_set_sign(c, sign);
+}
+
+/*
+ * A negative a rounds away from zero: -(|a| >> nbits) - 1 when any bit shifted
+ * out is set, as for the two's complement.
+ */
+void
+bignum_shr(const bignum *a, int nbits, bignum *c)
+{
+  int size, w, s, n, neg, lost;
+
+  assert(a != NULL && c != NULL);
+  assert(nbits >= 0);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_SHIFT, a->size);
+
+  size = a->size;
+  neg = a->sign == BIGNUM_NEGATIVE;
+  w = nbits / BIGNUM_SHIFT;
+  s = nbits % BIGNUM_SHIFT;
+
+  if (w >= size) {
+    bignum_assign_int(c, neg ? -1 : 0);
+    return;
+  }
+
+  n = size - w;
+
+  lost = 0;
+  if (neg) {
+    for (int i = 0; i < w && !lost; i++) {
+      lost = a->digit[i] != 0;
+    }
+    if (s > 0 && (a->digit[w] & (((word)1 << s) - 1)) != 0) {
+      lost = 1;
+    }
+  }
+
+  if (c != a) {
+    c->sign = BIGNUM_POSITIVE;
+    bignum_resize(c, n);
+    if (s > 0) {
+      bignum_rshift_digits(c->digit, a->digit + w, n, s);
+    } else {
+      memcpy(c->digit, a->digit + w, sizeof(word) * n);
+    }
+  } else {
+    /* Move the digits down, then shift the bits in place. */
+    if (w > 0) {
+      memmove(c->digit, c->digit + w, sizeof(word) * n);
+    }
+    if (s > 0) {
+      bignum_rshift_digits(c->digit, c->digit, n, s);
+    }
+    c->size = n;
+  }
+
+  bignum_normalize(c);
+  if (lost) {
+    word carry = bignum_add_1(c->digit, c->digit, c->size, 1);
+    if (carry != 0) {
+      bignum_resize(c, c->size + 1);
+      c->digit[c->size - 1] = carry;
+    }
+  }
+  bignum_set_sign(c, neg ? BIGNUM_NEGATIVE : BIGNUM_POSITIVE);
+}
+
+/*
+ * c = |a| + |b|. The digits of a and b are read after c is resized, because
+ * the resize may move the buffer of an aliased operand.
+ */
+static void
+bignum_add_a(const bignum *a, const bignum *b, bignum *c)
+{
+  int size_a, size_b;
+
+  size_a = a->size;
+  size_b = b->size;
+
+  if (size_a < size_b) {
+    { const bignum *tmp = a; a = b; b = tmp; }
+    { int tmp = size_a; size_a = size_b; size_b = tmp; }
+  }
+
+  c->sign = BIGNUM_POSITIVE;
+  bignum_resize(c, size_a + 1);
+
+  c->digit[size_a] = bignum_add_digits(c->digit, a->digit, size_a, b->digit, size_b);
+  bignum_normalize(c);
+}
+
+/*
+ * c = |a| - |b|.
+ */
+static void
+bignum_sub_a(const bignum *a, const bignum *b, bignum *c)
+{
+  int size_a, size_b, sign, i;
+  word borrow;
+
+  sign = BIGNUM_POSITIVE;
+  size_a = a->size;
+  size_b = b->size;
+
+  if (size_a < size_b) {
+    { const bignum *tmp = a; a = b; b = tmp; }
+    { int tmp = size_a; size_a = size_b; size_b = tmp; }
+    sign = BIGNUM_NEGATIVE;
+  } else if (size_a == size_b) {
+    i = size_a - 1;
+
+    while (i >= 0 && a->digit[i] == b->digit[i]) {
+      i--;
+    }
+
+    if (i < 0) {
+      bignum_assign_int(c, 0);  /* Numbers are equal. */
+      return;
+    }
+
+    if (a->digit[i] < b->digit[i]) {
+      { const bignum *tmp = a; a = b; b = tmp; }
+      sign = BIGNUM_NEGATIVE;
+    }
+
+    size_a = size_b = i + 1;
+  }
+
+  c->sign = sign;
+  bignum_resize(c, size_a);
+
+  borrow = bignum_sub_digits(c->digit, a->digit, size_a, b->digit, size_b);
+  assert(borrow == 0);
+  (void)borrow;
+
+  bignum_normalize(c);
+}
+
+/*
+ * Multiplication of absolute values. The algorithm is chosen by
+ * bignum_mul_digits based on the length of the shorter operand.
+ */
+static void
+bignum_mul_a(const bignum *a, const bignum *b, bignum *c)
+{
+  int size_a, size_b;
+  bignum_scratch_mark mark;
+  word *r, *scratch = NULL;
+
+  size_a = a->size;
+  size_b = b->size;
+
+  if (size_a < size_b) {
+    { const bignum *tmp = a; a = b; b = tmp; }
+    { int tmp = size_a; size_a = size_b; size_b = tmp; }
+  }
+
+  mark = bignum_scratch_save();
+
+  /* The product cannot overlap the operands. */
+  if (c == a || c == b) {
+    r = bignum_scratch_alloc(sizeof(word) * (size_a + size_b));
+  } else {
+    c->sign = BIGNUM_POSITIVE;
+    bignum_resize(c, size_a + size_b);
+    r = c->digit;
+  }
+
+  if (bignum_mul_scratch_size(size_b) > 0) {
+    scratch = bignum_scratch_alloc(sizeof(word) * bignum_mul_scratch_size(size_b));
+  }
+
+  bignum_mul_digits(r, a->digit, size_a, b->digit, size_b, scratch);
+
+  if (r != c->digit) {
+    c->sign = BIGNUM_POSITIVE;
+    bignum_resize(c, size_a + size_b);
+    memcpy(c->digit, r, sizeof(word) * (size_a + size_b));
+  }
+
+  bignum_scratch_restore(mark);
+  bignum_normalize(c);
+}
+
+/*
+ * Number of scratch digits needed by bignum_mul_digits when the shorter operand
+ * has n digits. Covers the unbalanced slicing (2n per nesting level, the slice
+ * lengths decrease like Euclid's remainders) and the recursion of Karatsuba
+ * (~2n) and Toom-3 (~4n) with a constant per level.
+ */
+static int
+bignum_mul_scratch_size(int n)
+{
+  if (n < BIGNUM_MUL_KARATSUBA_THRESHOLD && n < BIGNUM_SQR_KARATSUBA_THRESHOLD) {
+    return 0;
+  }
+  return 16 * n + 2048;
+}
+
+/*
+ * Multiply a (na digits) by b (nb digits), na >= nb >= 1, into r (na + nb digits).
+ * r must not overlap a or b. a == b with na == nb is a squaring.
+ */
+static void
+bignum_mul_digits(word *r, const word *a, int na, const word *b, int nb, word *scratch)
+{
+  word *t;
+
+  assert(na >= nb && nb >= 1);
+
+  if (a == b && na == nb) {
+    bignum_sqr_n(r, a, na, scratch);
+    return;
+  }
+
+  if (nb < BIGNUM_MUL_KARATSUBA_THRESHOLD) {
+    bignum_mul_basecase(r, a, na, b, nb);
+    return;
+  }
+
+  if (nb >= BIGNUM_MUL_NTT_THRESHOLD && bignum_mul_ntt_fits(na, nb)) {
+    bignum_mul_ntt(r, a, na, b, nb);
+    return;
+  }
+
+  if (na == nb) {
+    bignum_mul_n(r, a, b, nb, scratch);
+    return;
+  }
+
+  /* Unbalanced operands. Multiply b by nb-digit slices of a. */
+  t = scratch;
+  scratch += 2 * nb;
+
+  bignum_mul_n(r, a, b, nb, scratch);
+  memset(r + 2 * nb, 0, sizeof(word) * (na - nb));
+
+  for (int off = nb; off < na; off += nb) {
+    int len = MIN(nb, na - off);
+
+    if (len == nb) {
+      bignum_mul_n(t, a + off, b, nb, scratch);
+    } else {
+      bignum_mul_digits(t, b, nb, a + off, len, scratch);
+    }
+    bignum_add_into(r + off, na + nb - off, t, len + nb);
+  }
+}
+
+/*
+ * Multiply two n-digit numbers into r (2n digits).
+ */
+static void
+bignum_mul_n(word *r, const word *a, const word *b, int n, word *scratch)
+{
+  if (n < BIGNUM_MUL_KARATSUBA_THRESHOLD) {
+    bignum_mul_basecase(r, a, n, b, n);
+  } else if (n < BIGNUM_MUL_TOOM3_THRESHOLD) {
+    bignum_mul_karatsuba(r, a, b, n, scratch);
+  } else if (n >= BIGNUM_MUL_NTT_THRESHOLD && bignum_mul_ntt_fits(n, n)) {
+    bignum_mul_ntt(r, a, n, b, n);
+  } else {
+    bignum_mul_toom3(r, a, b, n, scratch);
+  }
+}
+
+/*
+ * Primary school multiplication. na, nb >= 1.
+ */
+static void
+bignum_mul_basecase(word *r, const word *a, int na, const word *b, int nb)
+{
+  BIGNUM_STAT(mul_basecase, 1);
+
+  r[nb] = bignum_mul_1(r, b, nb, a[0]);
+  for (int i = 1; i < na; i++) {
+    r[i + nb] = bignum_addmul_1(r + i, b, nb, a[i]);
+  }
+}
+
+/*
+ * Karatsuba multiplication. With a = a1*B^l + a0 and b = b1*B^l + b0:
+ *
+ *  a*b = a1*b1*B^2l + (a0*b0 + a1*b1 - (a0 - a1)(b0 - b1))*B^l + a0*b0
+ *
+ * Uses 4l + 1 scratch digits plus the scratch of the recursive calls.
+ */
+static void
+bignum_mul_karatsuba(word *r, const word *a, const word *b, int n, word *scratch)
+{
+  int l, h, sa, sb;
+  word *zm, *da, *db, *t, *next;
+
+  BIGNUM_STAT(mul_karatsuba, 1);
+
+  l = (n + 1) / 2;
+  h = n - l;
+
+  zm = scratch;
+  da = scratch + 2 * l;
+  db = da + l;
+  t = da;  /* Reuses da and db once zm is known. */
+  next = scratch + 4 * l + 1;
+
+  sa = bignum_sub_abs(da, a, l, a + l, h);
+  sb = bignum_sub_abs(db, b, l, b + l, h);
+
+  bignum_mul_n(zm, da, db, l, next);
+  bignum_mul_n(r, a, b, l, next);
+  bignum_mul_n(r + 2 * l, a + l, b + l, h, next);
+
+  t[2 * l] = bignum_add_digits(t, r, 2 * l, r + 2 * l, 2 * h);
+  if (sa == sb) {
+    t[2 * l] -= bignum_sub_n(t, t, zm, 2 * l);
+  } else {
+    t[2 * l] += bignum_add_n(t, t, zm, 2 * l);
+  }
+
+  bignum_add_into(r + l, 2 * n - l, t, 2 * l + 1);
+}
+
+/*
+ * Evaluate the Toom-3 polynomial a0 + a1*x + a2*x^2 (k, k and s digits) at
+ * 1, -1 and 2. The results have k + 1 digits. Return 1 if the value at -1
+ * is negative (pm1 holds its absolute value).
+ */
+static int
+bignum_toom3_eval(word *p1, word *pm1, word *p2, const word *a, int k, int s)
+{
+  const word *a0 = a, *a1 = a + k, *a2 = a + 2 * k;
+  int neg;
+
+  p1[k] = bignum_add_digits(p1, a0, k, a2, s);
+  neg = bignum_sub_abs(pm1, p1, k + 1, a1, k);
+  p1[k] += bignum_add_n(p1, p1, a1, k);
+
+  /* p2 = ((a2*2 + a1)*2 + a0 */
+  memcpy(p2, a2, sizeof(word) * s);
+  memset(p2 + s, 0, sizeof(word) * (k + 1 - s));
+  bignum_lshift_digits(p2, p2, k + 1, 1);
+  p2[k] += bignum_add_n(p2, p2, a1, k);
+  bignum_lshift_digits(p2, p2, k + 1, 1);
+  p2[k] += bignum_add_n(p2, p2, a0, k);
+
+  return neg;
+}
+
+/*
+ * The five point products of a Toom-3 step, run in parallel. b[i] == NULL
+ * means squaring.
+ */
+typedef struct bignum_toom3_job {
+  word *r[5];
+  const word *a[5];
+  const word *b[5];
+  int n[5];
+} bignum_toom3_job;
+
+static void
+bignum_toom3_task(void *arg, int i)
+{
+  bignum_toom3_job *job = arg;
+  bignum_scratch_mark mark = bignum_scratch_save();
+  word *scratch = bignum_scratch_alloc(sizeof(word) * bignum_mul_scratch_size(job->n[i]));
+
+  if (job->b[i] == NULL) {
+    bignum_sqr_n(job->r[i], job->a[i], job->n[i], scratch);
+  } else {
+    bignum_mul_n(job->r[i], job->a[i], job->b[i], job->n[i], scratch);
+  }
+
+  bignum_scratch_restore(mark);
+}
+
+/*
+ * Toom-Cook 3-way multiplication. Operands are split into three parts of
+ * k = ceil(n/3) digits, the product polynomial is evaluated at 0, 1, -1, 2 and
+ * infinity and interpolated with Bodrato's sequence. All interpolation
+ * intermediates are non-negative, only the value at -1 carries a sign.
+ *
+ * Uses 12(k + 1) scratch digits plus the scratch of the recursive calls.
+ */
+static void
+bignum_mul_toom3(word *r, const word *a, const word *b, int n, word *scratch)
+{
+  int k, s, k1, vn, neg;
+  word *p1, *q1, *pm1, *qm1, *p2, *q2, *v1, *vm1, *v2, *next;
+
+  BIGNUM_STAT(mul_toom3, 1);
+
+  k = (n + 2) / 3;
+  s = n - 2 * k;
+  k1 = k + 1;
+  vn = 2 * k1;
+  assert(s >= 1);
+
+  p1 = scratch;
+  q1 = p1 + k1;
+  pm1 = q1 + k1;
+  qm1 = pm1 + k1;
+  p2 = qm1 + k1;
+  q2 = p2 + k1;
+  v1 = q2 + k1;
+  vm1 = v1 + vn;
+  v2 = vm1 + vn;
+  next = v2 + vn;
+
+  neg = bignum_toom3_eval(p1, pm1, p2, a, k, s);
+  neg ^= bignum_toom3_eval(q1, qm1, q2, b, k, s);
+
+  if (n >= BIGNUM_MUL_PARALLEL_THRESHOLD && bignum_pool_size > 0) {
+    bignum_toom3_job job = {
+      { v1, vm1, v2, r, r + 4 * k },
+      { p1, pm1, p2, a, a + 2 * k },
+      { q1, qm1, q2, b, b + 2 * k },
+      { k1, k1, k1, k, s },
+    };
+    bignum_parallel_for(5, bignum_toom3_task, &job);
+  } else {
+    bignum_mul_n(v1, p1, q1, k1, next);
+    bignum_mul_n(vm1, pm1, qm1, k1, next);
+    bignum_mul_n(v2, p2, q2, k1, next);
+    bignum_mul_n(r, a, b, k, next);
+    bignum_mul_n(r + 4 * k, a + 2 * k, b + 2 * k, s, next);
+  }
+
+  bignum_toom3_interpolate(r, v1, vm1, v2, n, k, neg);
+}
+
+/*
+ * Interpolation of bignum_mul_toom3. v0 and vinf are already in r, v1, vm1
+ * and v2 have 2(k + 1) digits, and neg is the sign of vm1.
+ */
+static void
+bignum_toom3_interpolate(word *r, word *v1, word *vm1, word *v2, int n, int k, int neg)
+{
+  int s, vn;
+  word *v0, *vinf;
+
+  s = n - 2 * k;
+  vn = 2 * (k + 1);
+  v0 = r;
+  vinf = r + 4 * k;
+
+  /* v2 = (v2 - vm1) / 3 */
+  if (neg) {
+    bignum_add_n(v2, v2, vm1, vn);
+  } else {
+    bignum_sub_n(v2, v2, vm1, vn);
+  }
+  bignum_divexact_by3(v2, v2, vn);
+
+  /* vm1 = (v1 - vm1) / 2 */
+  if (neg) {
+    bignum_add_n(vm1, v1, vm1, vn);
+  } else {
+    bignum_sub_n(vm1, v1, vm1, vn);
+  }
+  bignum_rshift_digits(vm1, vm1, vn, 1);
+
+  /* v1 = v1 - v0 */
+  bignum_sub_digits(v1, v1, vn, v0, 2 * k);
+
+  /* v2 = (v2 - v1) / 2 */
+  bignum_sub_n(v2, v2, v1, vn);
+  bignum_rshift_digits(v2, v2, vn, 1);
+
+  /* v1 = v1 - vm1 - vinf */
+  bignum_sub_n(v1, v1, vm1, vn);
+  bignum_sub_digits(v1, v1, vn, vinf, 2 * s);
+
+  /* v2 = v2 - 2*vinf */
+  bignum_sub_digits(v2, v2, vn, vinf, 2 * s);
+  bignum_sub_digits(v2, v2, vn, vinf, 2 * s);
+
+  /* vm1 = vm1 - v2 */
+  bignum_sub_n(vm1, vm1, v2, vn);
+
+  /* Coefficients 1, 2 and 3 are now in vm1, v1 and v2. */
+  memset(r + 2 * k, 0, sizeof(word) * 2 * k);
+  bignum_add_into(r + k, 2 * n - k, vm1, vn);
+  bignum_add_into(r + 2 * k, 2 * n - 2 * k, v1, vn);
+  bignum_add_into(r + 3 * k, 2 * n - 3 * k, v2, vn);
+}
+
+/*
+ * Square the n-digit number a into r (2n digits).
+ */
+static void
+bignum_sqr_n(word *r, const word *a, int n, word *scratch)
+{
+  if (n < BIGNUM_SQR_KARATSUBA_THRESHOLD) {
+    bignum_sqr_basecase(r, a, n);
+  } else if (n < BIGNUM_MUL_TOOM3_THRESHOLD) {
+    bignum_sqr_karatsuba(r, a, n, scratch);
+  } else if (n >= BIGNUM_MUL_NTT_THRESHOLD && bignum_mul_ntt_fits(n, n)) {
+    bignum_mul_ntt(r, a, n, a, n);
+  } else {
+    bignum_sqr_toom3(r, a, n, scratch);
+  }
+}
+
+/*
+ * Schoolbook squaring. The products a[i]*a[j], i < j, are summed once and
+ * doubled, then the squares a[i]^2 are added on the diagonal.
+ */
+static void
+bignum_sqr_basecase(word *r, const word *a, int n)
+{
+  dword carry, p;
+
+  BIGNUM_STAT(sqr_basecase, 1);
+
+  r[0] = 0;
+  r[2 * n - 1] = 0;
+  if (n > 1) {
+    r[n] = bignum_mul_1(r + 1, a + 1, n - 1, a[0]);
+    for (int i = 1; i < n - 1; i++) {
+      r[n + i] = bignum_addmul_1(r + 2 * i + 1, a + i + 1, n - i - 1, a[i]);
+    }
+  }
+
+  bignum_lshift_digits(r, r, 2 * n, 1);
+
+  carry = 0;
+  for (int i = 0; i < n; i++) {
+    p = (dword)a[i] * a[i];
+    carry += (dword)r[2 * i] + (word)p;
+    r[2 * i] = (word)carry;
+    carry >>= BIGNUM_SHIFT;
+    carry += (dword)r[2 * i + 1] + (word)(p >> BIGNUM_SHIFT);
+    r[2 * i + 1] = (word)carry;
+    carry >>= BIGNUM_SHIFT;
+  }
+}
+
+/*
+ * Karatsuba squaring: a^2 = a1^2*B^2l + (a0^2 + a1^2 - (a0 - a1)^2)*B^l + a0^2.
+ * Uses the scratch layout of bignum_mul_karatsuba.
+ */
+static void
+bignum_sqr_karatsuba(word *r, const word *a, int n, word *scratch)
+{
+  int l, h;
+  word *zm, *da, *t, *next;
+
+  BIGNUM_STAT(sqr_karatsuba, 1);
+
+  l = (n + 1) / 2;
+  h = n - l;
+
+  zm = scratch;
+  da = scratch + 2 * l;
+  t = da;
+  next = scratch + 4 * l + 1;
+
+  bignum_sub_abs(da, a, l, a + l, h);
+
+  bignum_sqr_n(zm, da, l, next);
+  bignum_sqr_n(r, a, l, next);
+  bignum_sqr_n(r + 2 * l, a + l, h, next);
+
+  t[2 * l] = bignum_add_digits(t, r, 2 * l, r + 2 * l, 2 * h);
+  t[2 * l] -= bignum_sub_n(t, t, zm, 2 * l);
+
+  bignum_add_into(r + l, 2 * n - l, t, 2 * l + 1);
+}
+
+/*
+ * Toom-3 squaring. The evaluation is done once and the value at -1 squares
+ * to a non-negative number. Uses the scratch layout of bignum_mul_toom3.
+ */
+static void
+bignum_sqr_toom3(word *r, const word *a, int n, word *scratch)
+{
+  int k, s, k1, vn;
+  word *p1, *pm1, *p2, *v1, *vm1, *v2, *next;
+
+  BIGNUM_STAT(sqr_toom3, 1);
+
+  k = (n + 2) / 3;
+  s = n - 2 * k;
+  k1 = k + 1;
+  vn = 2 * k1;
+  assert(s >= 1);
+
+  p1 = scratch;
+  pm1 = p1 + k1;
+  p2 = pm1 + k1;
+  v1 = p2 + k1;
+  vm1 = v1 + vn;
+  v2 = vm1 + vn;
+  next = v2 + vn;
+
+  bignum_toom3_eval(p1, pm1, p2, a, k, s);
+
+  if (n >= BIGNUM_MUL_PARALLEL_THRESHOLD && bignum_pool_size > 0) {
+    bignum_toom3_job job = {
+      { v1, vm1, v2, r, r + 4 * k },
+      { p1, pm1, p2, a, a + 2 * k },
+      { NULL, NULL, NULL, NULL, NULL },
+      { k1, k1, k1, k, s },
+    };
+    bignum_parallel_for(5, bignum_toom3_task, &job);
+  } else {
+    bignum_sqr_n(v1, p1, k1, next);
+    bignum_sqr_n(vm1, pm1, k1, next);
+    bignum_sqr_n(v2, p2, k1, next);
+    bignum_sqr_n(r, a, k, next);
+    bignum_sqr_n(r + 4 * k, a + 2 * k, s, next);
+  }
+
+  bignum_toom3_interpolate(r, v1, vm1, v2, n, k, 0);
+}
+
+static void
+bignum_div_a(const bignum *a, const bignum *b, bignum *c)
+{
+  if (b->size == 1) {
+    bignum_div_a1(a, b, c);
+    return;
+  }
+
+  if (a->size < b->size) {
+    bignum_assign_int(c, 0);
+    return;
+  }
+
+  bignum_div_a2(a, b, c);
+}
+
+/*
+ * Linear time division. Assuming length of b is 1.
+ */
+static void
+bignum_div_a1(const bignum *a, const bignum *b, bignum *c)
+{
+  assert(b->size == 1);
+
+  word digit = b->digit[0];
+  int size = a->size;
+
+  c->sign = BIGNUM_POSITIVE;
+  bignum_resize(c, size);
+
+  BIGNUM_STAT(div_1, 1);
+  bignum_divrem_1(c->digit, a->digit, size, digit);
+
+  bignum_normalize(c);
+}
+
+/*
+ * Division of absolute values with at least two digits in b.
+ */
+static void
+bignum_div_a2(const bignum *a, const bignum *b, bignum *c)
+{
+  int n, m;
+
+  assert(a->size >= b->size && b->size >= 2);
+
+  n = b->size;
+  m = a->size - b->size;
+
+  /* The operands are copied before the quotient is written, so c may be one
+     of them. Resizing keeps their digits. */
+  c->sign = BIGNUM_POSITIVE;
+  bignum_resize(c, m + 1);
+
+  bignum_divrem_digits(c->digit, NULL, a->digit, n + m, b->digit, n);
+
+  bignum_normalize(c);
+}
+
+/*
+ * q = |a| / |b| and r = |a| % |b| from one division. q may be NULL when only
+ * the remainder is needed. Either result may be the same object as a or b.
+ */
+static void
+bignum_divmod_a(const bignum *a, const bignum *b, bignum *q, bignum *r)
+{
+  bignum_scratch_mark mark;
+  word *quot;
+  int n, m;
+
+  assert(r != NULL && q != r);
+
+  if (a->size < b->size) {
+    if (r != a) {
+      bignum_assign(r, a);
+    }
+    r->sign = BIGNUM_POSITIVE;
+    if (q != NULL) {
+      bignum_assign_int(q, 0);
+    }
+    return;
+  }
+
+  n = b->size;
+  m = a->size - b->size;
+
+  /* Resizing keeps the digits of an aliased operand, whose size is saved
+     above, and the digits are read after both resizes. */
+  mark = bignum_scratch_save();
+  if (q != NULL) {
+    q->sign = BIGNUM_POSITIVE;
+    bignum_resize(q, m + 1);
+  }
+  r->sign = BIGNUM_POSITIVE;
+  bignum_resize(r, n);
+
+  quot = q != NULL ? q->digit : bignum_scratch_alloc(sizeof(word) * (m + 1));
+  bignum_divrem_digits(quot, r->digit, a->digit, n + m, b->digit, n);
+  bignum_scratch_restore(mark);
+
+  if (q != NULL) {
+    bignum_normalize(q);
+  }
+  bignum_normalize(r);
+}
+
+/*
+ * q = a / d (na - nd + 1 digits) and r = a % d (nd digits, unless r is NULL),
+ * na >= nd >= 1 and the top digit of d is not zero. q and r may overlap a or d.
+ * The normalized operands live in the scratch arena.
+ */
+static void
+bignum_divrem_digits(word *q, word *r, const word *a, int na, const word *d, int nd)
+{
+  bignum_scratch_mark mark;
+  word *u, *v, qh;
+  int n, m, s;
+
+  assert(na >= nd && nd >= 1 && d[nd - 1] != 0);
+
+  if (nd == 1) {
+    word rem;
+
+    BIGNUM_STAT(div_1, 1);
+    rem = bignum_divrem_1(q, a, na, d[0]);
+    if (r != NULL) {
+      r[0] = rem;
+    }
+    return;
+  }
+
+  n = nd;
+  m = na - nd;
+
+  mark = bignum_scratch_save();
+  u = bignum_scratch_alloc(sizeof(word) * (n + m + 1));
+  v = bignum_scratch_alloc(sizeof(word) * n);
+
+  /* Normalization step. Make sure that the MSD of v >= BIGNUM_BASE/2. */
+  s = BIGNUM_SHIFT - bignum_bit_length(d[n - 1]);
+  if (s > 0) {
+    u[n + m] = bignum_lshift_digits(u, a, n + m, s);
+    bignum_lshift_digits(v, d, n, s);
+  } else {
+    memcpy(u, a, sizeof(word) * (n + m));
+    u[n + m] = 0;
+    memcpy(v, d, sizeof(word) * n);
+  }
+  assert(v[n - 1] >= BIGNUM_BASE / 2);
+
+  qh = bignum_div_qr(q, u, n + m + 1, v, n);
+  assert(qh == 0);
+  (void)qh;
+
+  /* Unnormalize the remainder. */
+  if (r != NULL) {
+    if (s > 0) {
+      bignum_rshift_digits(r, u, n, s);
+    } else {
+      memcpy(r, u, sizeof(word) * n);
+    }
+  }
+
+  bignum_scratch_restore(mark);
+}
+
+/*
+ * Divide u (nu digits) by the normalized v (n >= 2 digits, top bit set). The
+ * quotient goes to q (nu - n digits) plus the returned high digit (0 or 1),
+ * the remainder to the low n digits of u.
+ */
+static word
+bignum_div_qr(word *q, word *u, int nu, const word *v, int n)
+{
+  if (n < BIGNUM_DIV_BZ_THRESHOLD || nu - n < BIGNUM_DIV_BZ_THRESHOLD) {
+    return bignum_div_qr_basecase(q, u, nu, v, n);
+  }
+  if (n >= BIGNUM_DIV_NEWTON_THRESHOLD && nu - n >= BIGNUM_DIV_NEWTON_THRESHOLD) {
+    return bignum_div_qr_newton(q, u, nu, v, n);
+  }
+  return bignum_div_qr_dc(q, u, nu, v, n);
+}
+
+/*
+ * bignum_div_qr by Knuth's algorithm in TAOCP vol. 2 (3rd ed.), section 4.3.1,
+ * Algorithm D.
+ */
+static word
+bignum_div_qr_basecase(word *q, word *u, int nu, const word *v, int n)
+{
+  dword qhat, rhat, uu;
+  word qh, borrow, top;
+
+  assert(nu >= n && n >= 2);
+  BIGNUM_STAT(div_basecase, 1);
+
+  qh = bignum_cmp_digits(u + nu - n, n, v, n) >= 0;
+  if (qh) {
+    bignum_sub_n(u + nu - n, u + nu - n, v, n);
+  }
+
+  for (int j = nu - n - 1; j >= 0; j--) {
+    /* u[j + 1 .. j + n] < v, so u[j + n] <= v[n - 1]. */
+    uu = (dword)u[j + n] << BIGNUM_SHIFT | u[j + n - 1];
+
+    if (u[j + n] == v[n - 1]) {
+      qhat = BIGNUM_MASK;
+      rhat = uu - qhat * v[n - 1];
+    } else {
+      qhat = uu / v[n - 1];
+      rhat = uu % v[n - 1];
+    }
+
+    while (rhat < BIGNUM_BASE &&
+           qhat * v[n - 2] > ((rhat << BIGNUM_SHIFT) | u[j + n - 2])) {
+      qhat--;
+      rhat += v[n - 1];
+      BIGNUM_STAT(div_qhat_adjust, 1);
+    }
+
+    borrow = bignum_submul_1(u + j, v, n, (word)qhat);
+    top = u[j + n];
+    u[j + n] = top - borrow;
+
+    /* This branch is taken with probability ~ 2/BIGNUM_BASE. */
+    if (top < borrow) {
+      qhat--;
+      u[j + n] += bignum_add_n(u + j, u + j, v, n);
+      BIGNUM_STAT(div_add_back, 1);
+    }
+    assert(u[j + n] == 0);
+
+    q[j] = (word)qhat;
+  }
+
+  return qh;
+}
+
+/*
+ * bignum_div_qr by Burnikel and Ziegler's recursive division, in the form of
+ * GMP's mpn_dcpi1_div_qr. The quotient is produced in blocks of n digits
+ * from the top, each by bignum_div_qr_n, except for a shorter first block.
+ */
+static word
+bignum_div_qr_dc(word *q, word *u, int nu, const word *v, int n)
+{
+  word qh, ql;
+  int qn, k;
+
+  BIGNUM_STAT(div_bz, 1);
+
+  qn = nu - n;
+  assert(qn >= 1 && n >= BIGNUM_DIV_BZ_THRESHOLD);
+
+  qh = bignum_cmp_digits(u + qn, n, v, n) >= 0;
+  if (qh) {
+    bignum_sub_n(u + qn, u + qn, v, n);
+  }
+
+  k = qn % n;
+  if (k > 0) {
+    qn -= k;
+    bignum_div_qr_top(q + qn, u + qn, v, n, k);
+  }
+
+  while (qn > 0) {
+    qn -= n;
+    ql = bignum_div_qr_n(q + qn, u + qn, v, n);
+    assert(ql == 0);
+    (void)ql;
+  }
+
+  return qh;
+}
+
+/*
+ * Divide the window u (n + k digits, the top n digits less than v) by the
+ * normalized v (n digits), k < n, into q (k digits). The top 2k digits of u
+ * are divided by the top k digits of v and the quotient is corrected with the
+ * rest of v.
+ */
+static void
+bignum_div_qr_top(word *q, word *u, const word *v, int n, int k)
+{
+  bignum_scratch_mark mark;
+  word *w, *t, *scratch = NULL;
+  word ql, cy;
+
+  assert(k >= 1 && k < n);
+
+  w = u + n - k;
+
+  if (k == 1) {
+    dword uu;
+
+    ql = w[1] >= v[n - 1];
+    if (ql) {
+      w[1] -= v[n - 1];
+    }
+    uu = (dword)w[1] << BIGNUM_SHIFT | w[0];
+    q[0] = (word)(uu / v[n - 1]);
+    w[0] = (word)(uu % v[n - 1]);
+    w[1] = 0;
+  } else {
+    ql = bignum_div_qr(q, w, 2 * k, v + n - k, k);
+  }
+
+  mark = bignum_scratch_save();
+  t = bignum_scratch_alloc(sizeof(word) * n);
+  if (bignum_mul_scratch_size(MIN(k, n - k)) > 0) {
+    scratch = bignum_scratch_alloc(sizeof(word) * bignum_mul_scratch_size(MIN(k, n - k)));
+  }
+
+  if (k >= n - k) {
+    bignum_mul_digits(t, q, k, v, n - k, scratch);
+  } else {
+    bignum_mul_digits(t, v, n - k, q, k, scratch);
+  }
+
+  cy = bignum_sub_n(u, u, t, n);
+  if (ql) {
+    cy += bignum_sub_n(u + k, u + k, v, n - k);
+  }
+  while (cy != 0) {
+    ql -= bignum_sub_1(q, q, k, 1);
+    cy -= bignum_add_n(u, u, v, n);
+  }
+  assert(ql == 0);
+
+  bignum_scratch_restore(mark);
+}
+
+/*
+ * Divide u (2n digits) by the normalized v (n digits) recursively, splitting
+ * the quotient into a high and a low half. Same results as bignum_div_qr.
+ */
+static word
+bignum_div_qr_n(word *q, word *u, const word *v, int n)
+{
+  bignum_scratch_mark mark;
+  word *t, *scratch = NULL;
+  word qh, ql, cy;
+  int lo, hi;
+
+  lo = n / 2;
+  hi = n - lo;
+
+  mark = bignum_scratch_save();
+  t = bignum_scratch_alloc(sizeof(word) * n);
+  if (bignum_mul_scratch_size(lo) > 0) {
+    scratch = bignum_scratch_alloc(sizeof(word) * bignum_mul_scratch_size(lo));
+  }
+
+  /* High half of the quotient from the top 2hi digits of u and hi digits of v. */
+  if (hi < BIGNUM_DIV_BZ_THRESHOLD) {
+    qh = bignum_div_qr_basecase(q + lo, u + 2 * lo, 2 * hi, v + lo, hi);
+  } else {
+    qh = bignum_div_qr_n(q + lo, u + 2 * lo, v + lo, hi);
+  }
+
+  bignum_mul_digits(t, q + lo, hi, v, lo, scratch);
+
+  cy = bignum_sub_n(u + lo, u + lo, t, n);
+  if (qh) {
+    cy += bignum_sub_n(u + n, u + n, v, lo);
+  }
+  while (cy != 0) {
+    qh -= bignum_sub_1(q + lo, q + lo, hi, 1);
+    cy -= bignum_add_n(u + lo, u + lo, v, n);
+  }
+
+  /* Low half of the quotient. */
+  if (lo < BIGNUM_DIV_BZ_THRESHOLD) {
+    ql = bignum_div_qr_basecase(q, u + hi, 2 * lo, v + hi, lo);
+  } else {
+    ql = bignum_div_qr_n(q, u + hi, v + hi, lo);
+  }
+
+  bignum_mul_digits(t, v, hi, q, lo, scratch);
+
+  cy = bignum_sub_n(u, u, t, n);
+  if (ql) {
+    cy += bignum_sub_n(u + lo, u + lo, v, hi);
+  }
+  while (cy != 0) {
+    bignum_sub_1(q, q, lo, 1);
+    cy -= bignum_add_n(u, u, v, n);
+  }
+
+  bignum_scratch_restore(mark);
+  return qh;
+}
+
+/*
+ * bignum_div_qr from an approximate reciprocal of v, found by Newton's
+ * iteration, in the form of GMP's mpn_mu_div_qr. The quotient is produced in
+ * blocks of k <= n digits from the top, the first one possibly shorter, each
+ * estimated from the reciprocal of the top k digits of v and corrected with
+ * the remainder.
+ */
+static word
+bignum_div_qr_newton(word *q, word *u, int nu, const word *v, int n)
+{
+  bignum_scratch_mark mark;
+  word *x, qh;
+  int qn, k, kb, blocks, m;
+
+  BIGNUM_STAT(div_newton, 1);
+
+  qn = nu - n;
+  assert(qn >= 1 && n >= BIGNUM_DIV_NEWTON_THRESHOLD);
+
+  qh = bignum_cmp_digits(u + qn, n, v, n) >= 0;
+  if (qh) {
+    bignum_sub_n(u + qn, u + qn, v, n);
+  }
+
+  blocks = (qn + n - 1) / n;
+  k = (qn + blocks - 1) / blocks;
+
+  mark = bignum_scratch_save();
+  x = bignum_scratch_alloc(sizeof(word) * (k + 1));
+  bignum_div_inverse(x, v + n - k, k);
+
+  /* The remainders are below a few times v, so they are taken modulo
+     B^m - 1 with m >= n + 2. */
+  m = bignum_mul_wrap_size(n + 2);
+
+  kb = qn - (blocks - 1) * k;
+  while (qn > 0) {
+    qn -= kb;
+    bignum_div_qr_preinv(q + qn, u + qn, kb, v, n, x, k, m);
+    kb = k;
+  }
+
+  bignum_scratch_restore(mark);
+  return qh;
+}
+
+/*
+ * Divide the window w (n + k digits, the top n digits less than v) by the
+ * normalized v (n digits) into q (k digits), given x (h + 1 digits, k <= h)
+ * within 3 of B^2h / vh, where vh is the top h digits of v.
+ *
+ * With w1 the top k digits of w, the estimate floor(w1 * x / B^h) is at most
+ * 5 below and 7 above the quotient. The remainder w - q * v is then below
+ * 7v in absolute value, so the product with v is only needed modulo
+ * B^m - 1, m >= n + 2. The final correction steps q to the quotient one unit
+ * at a time.
+ */
+static void
+bignum_div_qr_preinv(word *q, word *w, int k, const word *v, int n, const word *x,
+                     int h, int m)
+{
+  bignum_scratch_mark mark;
+  word *t, *p, *r, *scratch = NULL;
+  int neg;
+
+  assert(k >= 1 && k <= h && h <= n && m >= n + 2);
+
+  mark = bignum_scratch_save();
+  t = bignum_scratch_alloc(sizeof(word) * (k + h + 1));
+  p = bignum_scratch_alloc(sizeof(word) * m);
+  r = bignum_scratch_alloc(sizeof(word) * m);
+  if (bignum_mul_scratch_size(k) > 0) {
+    scratch = bignum_scratch_alloc(sizeof(word) * bignum_mul_scratch_size(k));
+  }
+
+  bignum_mul_digits(t, x, h + 1, w + n, k, scratch);
+  if (t[h + k] != 0) {
+    /* The quotient has k digits. */
+    for (int i = 0; i < k; i++) {
+      q[i] = BIGNUM_MASK;
+    }
+  } else {
+    memcpy(q, t + h, sizeof(word) * k);
+  }
+
+  /* r = w - q * v modulo B^m - 1. */
+  if (n + k <= m) {
+    memcpy(r, w, sizeof(word) * (n + k));
+    memset(r + n + k, 0, sizeof(word) * (m - n - k));
+  } else {
+    word cy;
+
+    memcpy(r, w, sizeof(word) * m);
+    cy = bignum_add_digits(r, r, m, w + m, n + k - m);
+    while (cy != 0) {
+      cy = bignum_add_1(r, r, m, 1);
+    }
+  }
+  bignum_mul_wrap(p, v, n, q, k, m);
+  if (bignum_sub_n(r, r, p, m)) {
+    bignum_sub_1(r, r, m, 1);
+  }
+  neg = bignum_wrap_abs(r, m, n + 1);
+
+  while (neg) {
+    bignum_sub_1(q, q, k, 1);
+    BIGNUM_STAT(div_newton_adjust, 1);
+    if (bignum_cmp_digits(r, n + 1, v, n) <= 0) {
+      bignum_sub_n(r, v, r, n);
+      neg = 0;
+    } else {
+      bignum_sub_digits(r, r, n + 1, v, n);
+    }
+  }
+  while (r[n] != 0 || bignum_cmp_digits(r, n, v, n) >= 0) {
+    bignum_add_1(q, q, k, 1);
+    BIGNUM_STAT(div_newton_adjust, 1);
+    r[n] -= bignum_sub_n(r, r, v, n);
+  }
+
+  memcpy(w, r, sizeof(word) * n);
+
+  bignum_scratch_restore(mark);
+}
+
+/*
+ * x (h + 1 digits) within 3 of B^2h / v for the normalized v (h digits).
+ *
+ * Newton's iteration x' = x0 + x0 * (B^2h - v*x0) / B^2h from the reciprocal
+ * xl of the top l = h/2 + 1 digits of v and x0 = xl * B^(h-l), which is off
+ * by less than 7B^(h-l). The step squares the relative error, which leaves
+ * x' within 49/B plus 2 for the truncations. v*xl is close to B^(h+l), so
+ * it is taken modulo B^m - 1, m >= h + 2, and only the top of the residual
+ * is multiplied by xl.
+ */
+static void
+bignum_div_inverse(word *x, const word *v, int h)
+{
+  bignum_scratch_mark mark;
+  word *xl, *e, *t, *scratch = NULL;
+  word cy;
+  int l, m, ne, neg;
+
+  mark = bignum_scratch_save();
+
+  if (h < BIGNUM_DIV_NEWTON_THRESHOLD) {
+    word *u = bignum_scratch_alloc(sizeof(word) * (2 * h + 1));
+    word qh;
+
+    memset(u, 0, sizeof(word) * 2 * h);
+    u[2 * h] = 1;
+    qh = bignum_div_qr(x, u, 2 * h + 1, v, h);
+    assert(qh == 0);
+    (void)qh;
+
+    bignum_scratch_restore(mark);
+    return;
+  }
+
+  l = h / 2 + 1;
+  m = bignum_mul_wrap_size(h + 2);
+
+  xl = bignum_scratch_alloc(sizeof(word) * (l + 1));
+  e = bignum_scratch_alloc(sizeof(word) * m);
+  bignum_div_inverse(xl, v + h - l, l);
+
+  /* e = B^(h+l) - v*xl modulo B^m - 1, where -v*xl is the complement. */
+  bignum_mul_wrap(e, v, h, xl, l + 1, m);
+  for (int i = 0; i < m; i++) {
+    e[i] = (word)~e[i];
+  }
+  cy = bignum_add_1(e + (h + l) % m, e + (h + l) % m, m - (h + l) % m, 1);
+  while (cy != 0) {
+    cy = bignum_add_1(e, e, m, 1);
+  }
+  neg = bignum_wrap_abs(e, m, h + 1);
+
+  /* x = xl * B^(h-l) +- floor(xl * |e| / B^2l), leaving out the low l - 1
+     digits of |e|, which changes the result by less than one. */
+  memset(x, 0, sizeof(word) * (h - l));
+  memcpy(x + h - l, xl, sizeof(word) * (l + 1));
+
+  ne = h - l + 2;
+  while (ne > 0 && e[l - 1 + ne - 1] == 0) {
+    ne--;
+  }
+  if (ne > 0) {
+    t = bignum_scratch_alloc(sizeof(word) * (l + 1 + ne));
+    if (bignum_mul_scratch_size(MIN(l + 1, ne)) > 0) {
+      scratch = bignum_scratch_alloc(sizeof(word) * bignum_mul_scratch_size(MIN(l + 1, ne)));
+    }
+    if (l + 1 >= ne) {
+      bignum_mul_digits(t, xl, l + 1, e + l - 1, ne, scratch);
+    } else {
+      bignum_mul_digits(t, e + l - 1, ne, xl, l + 1, scratch);
+    }
+
+    if (neg) {
+      cy = bignum_sub_digits(x, x, h + 1, t + l + 1, ne);
+    } else {
+      cy = bignum_add_digits(x, x, h + 1, t + l + 1, ne);
+    }
+    assert(cy == 0);
+  }
+
+  bignum_scratch_restore(mark);
+}
+
+/*
+ * Replace the residue r (m digits) modulo B^m - 1 of a value below B^n in
+ * absolute value, n < m, by that absolute value (n digits). Return 1 if the
+ * value is negative. A negative value -a has the residue B^m - 1 - a, the
+ * complement of a.
+ */
+static int
+bignum_wrap_abs(word *r, int m, int n)
+{
+  int neg = r[m - 1] != 0;
+
+  for (int i = n; i < m; i++) {
+    assert(r[i] == (neg ? BIGNUM_MASK : 0));
+  }
+  if (neg) {
+    for (int i = 0; i < n; i++) {
+      r[i] = (word)~r[i];
+    }
+  }
+  return neg;
+}
+
+struct bignum_mont {
+  int n;       /* Digits of the modulus. */
+  int odd;
+  word minv;   /* -1/m mod BIGNUM_BASE, for odd moduli. */
+  word *mod;
+  word *r2;    /* BIGNUM_BASE^(2n) mod m, for odd moduli. */
+  word *mu;    /* Barrett reciprocal (n + 2 digits), for even moduli. */
+};
+
+bignum_mont *
+bignum_mont_new(bignum *m)
+{
+  bignum_scratch_mark mark;
+  bignum_mont *ctx;
+  word *u, *q;
+  int n;
+
+  assert(m != NULL);
+  assert(m->sign == BIGNUM_POSITIVE && bignum_is_zero(m) == 0);
+
+  n = m->size;
+
+  /* The digits follow the structure in the same block. */
+  ctx = bignum_mem_alloc(sizeof(bignum_mont) + sizeof(word) * (2 * n + 2));
+  if (ctx == NULL) {
+    /* todo: Error. */
+    return NULL;
+  }
+
+  ctx->n = n;
+  ctx->odd = m->digit[0] & 1;
+  ctx->mod = (word *)(ctx + 1);
+  ctx->r2 = ctx->mod + n;
+  ctx->mu = ctx->mod + n;
+  memcpy(ctx->mod, m->digit, sizeof(word) * n);
+
+  if (ctx->odd) {
+    ctx->minv = bignum_mont_inverse(m->digit[0]);
+
+    mark = bignum_scratch_save();
+    u = bignum_scratch_alloc(sizeof(word) * (2 * n + 1));
+    q = bignum_scratch_alloc(sizeof(word) * (n + 2));
+    memset(u, 0, sizeof(word) * 2 * n);
+    u[2 * n] = 1;
+    bignum_divrem_digits(q, ctx->r2, u, 2 * n + 1, ctx->mod, n);
+    bignum_scratch_restore(mark);
+  } else {
+    bignum_barrett_inverse(ctx->mu, ctx->mod, n);
+  }
+
+  return ctx;
+}
+
+void
+bignum_mont_free(bignum_mont *ctx)
+{
+  bignum_mem_free(ctx);
+}
+
+void
+bignum_powmod(bignum *a, bignum *e, bignum *m, bignum *c)
+{
+  bignum_mont *ctx;
+
+  ctx = bignum_mont_new(m);
+  if (ctx == NULL) {
+    /* todo: Error. */
+    return;
+  }
+
+  bignum_powmod_mont(ctx, a, e, c);
+  bignum_mont_free(ctx);
+}
+
+/*
+ * The base is reduced into [0, m) and converted to the Montgomery form
+ * a * BIGNUM_BASE^n mod m. All temporaries come from the scratch arena before
+ * the exponentiation starts.
+ */
+void
+bignum_powmod_mont(bignum_mont *ctx, bignum *a, bignum *e, bignum *c)
+{
+  bignum_scratch_mark mark;
+  word *g, *x, *t, *q;
+  int n;
+
+  assert(ctx != NULL && a != NULL && e != NULL && c != NULL);
+  assert(e->sign == BIGNUM_POSITIVE);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_POWMOD, a->size + e->size);
+
+  n = ctx->n;
+
+  mark = bignum_scratch_save();
+  g = bignum_scratch_alloc(sizeof(word) * n);
+  x = bignum_scratch_alloc(sizeof(word) * n);
+  t = bignum_scratch_alloc(sizeof(word) * bignum_mont_scratch_size(ctx));
+
+  if (a->size >= n) {
+    q = bignum_scratch_alloc(sizeof(word) * (a->size - n + 1));
+    bignum_divrem_digits(q, g, a->digit, a->size, ctx->mod, n);
+  } else {
+    memcpy(g, a->digit, sizeof(word) * a->size);
+    memset(g + a->size, 0, sizeof(word) * (n - a->size));
+  }
+
+  if (a->sign == BIGNUM_NEGATIVE && bignum_cmp_digits(g, n, g, 0) != 0) {
+    bignum_sub_n(g, ctx->mod, g, n);
+  }
+
+  if (bignum_is_zero(e)) {
+    /* a^0 = 1, which is 0 modulo 1. */
+    memset(x, 0, sizeof(word) * n);
+    x[0] = n > 1 || ctx->mod[0] != 1;
+  } else if (ctx->odd) {
+    bignum_mont_mul(ctx, g, g, ctx->r2, t);
+    bignum_mont_pow(ctx, x, g, e, t);
+
+    /* Back from the Montgomery form by a multiplication by 1. */
+    memset(g, 0, sizeof(word) * n);
+    g[0] = 1;
+    bignum_mont_mul(ctx, x, x, g, t);
+  } else {
+    bignum_mont_pow(ctx, x, g, e, t);
+  }
+
+  /* Written last, so c may be one of the operands. */
+  c->sign = BIGNUM_POSITIVE;
+  bignum_resize(c, n);
+  memcpy(c->digit, x, sizeof(word) * n);
+  bignum_normalize(c);
+
+  bignum_scratch_restore(mark);
+}
+
+/*
+ * -1/m0 mod BIGNUM_BASE for odd m0 by Newton's iteration. m0 is its own
+ * inverse modulo 8, and each step doubles the number of correct bits.
+ */
+static word
+bignum_mont_inverse(word m0)
+{
+  word inv = m0;
+
+  assert(m0 & 1);
+
+  for (int i = 0; i < 5; i++) {
+    inv = (word)((dword)inv * (word)(2 - (word)((dword)m0 * inv)));
+  }
+  return (word)(0 - inv);
+}
+
+/* Digits of the temporary passed to bignum_mont_mul. */
+static int
+bignum_mont_scratch_size(const bignum_mont *ctx)
+{
+  int n = ctx->n;
+
+  if (ctx->odd) {
+    return 2 * n + 1 + bignum_mul_scratch_size(n);
+  }
+  return 2 * n + bignum_barrett_scratch_size(n);  /* Also covers the product. */
+}
+
+/*
+ * r = a * b / BIGNUM_BASE^n mod m for odd m, or a * b mod m for even m, where
+ * a, b < m have n digits. r may be the same as a or b. The odd case interleaves
+ * the multiplication with Montgomery reduction digit by digit (CIOS): after
+ * step i the low i digits of t are zero, so the partial result is the window
+ * t + i and needs no shifting. Squares are computed first and then reduced,
+ * since the square costs half of a product.
+ */
+static void
+bignum_mont_mul(const bignum_mont *ctx, word *r, const word *a, const word *b, word *t)
+{
+  const word *m = ctx->mod;
+  int n = ctx->n;
+  dword s;
+  word *w;
+
+  if (!ctx->odd) {
+    bignum_mul_digits(t, a, n, b, n, t + 2 * n);
+    bignum_barrett_reduce(r, t, 2 * n, m, n, ctx->mu, t + 2 * n);
+    return;
+  }
+
+  if (a == b) {
+    bignum_sqr_n(t, a, n, t + 2 * n);
+    bignum_mont_redc(ctx, r, t);
+    return;
+  }
+
+  memset(t, 0, sizeof(word) * (2 * n + 1));
+
+  for (int i = 0; i < n; i++) {
+    dword c1 = 0, c2 = 0;
+    word bi = b[i], u;
+
+    w = t + i;
+    u = (word)((dword)(word)(w[0] + (word)((dword)a[0] * bi)) * ctx->minv);
+
+    /* w += a * b[i] + m * u in one pass. */
+    for (int j = 0; j < n; j++) {
+      c1 += (dword)a[j] * bi + w[j];
+      c2 += (dword)m[j] * u + (word)c1;
+      w[j] = (word)c2;
+      c1 >>= BIGNUM_SHIFT;
+      c2 >>= BIGNUM_SHIFT;
+    }
+
+    s = (dword)w[n] + c1 + c2;
+    w[n] = (word)s;
+    w[n + 1] += (word)(s >> BIGNUM_SHIFT);
+  }
+
+  /* The result is below 2m. */
+  if (t[2 * n] != 0 || bignum_cmp_digits(t + n, n, m, n) >= 0) {
+    bignum_sub_n(r, t + n, m, n);
+  } else {
+    memcpy(r, t + n, sizeof(word) * n);
+  }
+}
+
+/*
+ * r = t / BIGNUM_BASE^n mod m for t < m^2 (2n digits, overwritten). The carry
+ * of each step is kept in the digit it cleared and added back at the end.
+ */
+static void
+bignum_mont_redc(const bignum_mont *ctx, word *r, word *t)
+{
+  const word *m = ctx->mod;
+  int n = ctx->n;
+  word carry;
+
+  for (int i = 0; i < n; i++) {
+    t[i] = bignum_addmul_1(t + i, m, n, (word)((dword)t[i] * ctx->minv));
+  }
+  carry = bignum_add_n(t + n, t + n, t, n);
+
+  if (carry != 0 || bignum_cmp_digits(t + n, n, m, n) >= 0) {
+    bignum_sub_n(r, t + n, m, n);
+  } else {
+    memcpy(r, t + n, sizeof(word) * n);
+  }
+}
+
+/*
+ * r = g^e for e > 0 with the multiplication of ctx, scanning the exponent
+ * from the top with sliding windows of odd powers.
+ */
+static void
+bignum_mont_pow(const bignum_mont *ctx, word *r, const word *g, const bignum *e, word *t)
+{
+  bignum_scratch_mark mark;
+  word *table, *g2;
+  int n, bits, w, i, j, k, val;
+
+#define BIGNUM_EXP_BIT(i) ((e->digit[(i) / BIGNUM_SHIFT] >> ((i) % BIGNUM_SHIFT)) & 1)
+
+  n = ctx->n;
+  bits = (e->size - 1) * BIGNUM_SHIFT + bignum_bit_length(e->digit[e->size - 1]);
+  w = bignum_pow_window(bits);
+
+  /* table[k] = g^(2k+1) for k < 2^(w-1). */
+  mark = bignum_scratch_save();
+  table = bignum_scratch_alloc(sizeof(word) * ((size_t)n << (w - 1)));
+  memcpy(table, g, sizeof(word) * n);
+  if (w > 1) {
+    g2 = bignum_scratch_alloc(sizeof(word) * n);
+    bignum_mont_mul(ctx, g2, g, g, t);
+    for (k = 1; k < 1 << (w - 1); k++) {
+      bignum_mont_mul(ctx, table + k * n, table + (k - 1) * n, g2, t);
+    }
+  }
+
+  /* The top bit is set, so the first window initializes r. */
+  i = bits - 1;
+  while (i >= 0) {
+    if (!BIGNUM_EXP_BIT(i)) {
+      bignum_mont_mul(ctx, r, r, r, t);
+      i--;
+      continue;
+    }
+
+    /* The longest window of at most w bits ending with a set bit. */
+    j = MAX(i - w + 1, 0);
+    while (!BIGNUM_EXP_BIT(j)) {
+      j++;
+    }
+
+    val = 0;
+    for (k = i; k >= j; k--) {
+      val = val << 1 | (int)BIGNUM_EXP_BIT(k);
+    }
+
+    if (i == bits - 1) {
+      memcpy(r, table + (val >> 1) * n, sizeof(word) * n);
+    } else {
+      for (k = j; k <= i; k++) {
+        bignum_mont_mul(ctx, r, r, r, t);
+      }
+      bignum_mont_mul(ctx, r, r, table + (val >> 1) * n, t);
+    }
+    i = j - 1;
+  }
+
+#undef BIGNUM_EXP_BIT
+
+  bignum_scratch_restore(mark);
+}
+
+#define BIGNUM_BARRETT_SHORT_THRESHOLD (4 * BIGNUM_MUL_KARATSUBA_THRESHOLD)
+
+struct bignum_barrett {
+  int n;       /* Digits of the modulus. */
+  word *mod;
+  word *mu;    /* BIGNUM_BASE^(2n) / m, n + 2 digits. */
+};
+
+bignum_barrett *
+bignum_barrett_new(bignum *m)
+{
+  bignum_barrett *ctx;
+  int n;
+
+  assert(m != NULL);
+  assert(m->sign == BIGNUM_POSITIVE && bignum_is_zero(m) == 0);
+
+  n = m->size;
+
+  ctx = bignum_mem_alloc(sizeof(bignum_barrett) + sizeof(word) * (2 * n + 2));
+  if (ctx == NULL) {
+    /* todo: Error. */
+    return NULL;
+  }
+
+  ctx->n = n;
+  ctx->mod = (word *)(ctx + 1);
+  ctx->mu = ctx->mod + n;
+  memcpy(ctx->mod, m->digit, sizeof(word) * n);
+  bignum_barrett_inverse(ctx->mu, ctx->mod, n);
+
+  return ctx;
+}
+
+void
+bignum_barrett_free(bignum_barrett *ctx)
+{
+  bignum_mem_free(ctx);
+}
+
+/*
+ * Numbers of up to twice the digits of the modulus take the Barrett path,
+ * longer ones are divided.
+ */
+void
+bignum_mod_barrett(bignum_barrett *ctx, bignum *x, bignum *c)
+{
+  bignum_scratch_mark mark;
+  word *r, *t;
+  int n, nx;
+
+  assert(ctx != NULL && x != NULL && c != NULL);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_BARRETT, x->size);
+
+  n = ctx->n;
+  nx = x->size;
+
+  mark = bignum_scratch_save();
+  r = bignum_scratch_alloc(sizeof(word) * n);
+
+  if (nx <= 2 * n) {
+    t = bignum_scratch_alloc(sizeof(word) * bignum_barrett_scratch_size(n));
+    bignum_barrett_reduce(r, x->digit, nx, ctx->mod, n, ctx->mu, t);
+  } else {
+    t = bignum_scratch_alloc(sizeof(word) * (nx - n + 1));
+    bignum_divrem_digits(t, r, x->digit, nx, ctx->mod, n);
+  }
+
+  if (x->sign == BIGNUM_NEGATIVE && bignum_cmp_digits(r, n, r, 0) != 0) {
+    bignum_sub_n(r, ctx->mod, r, n);
+  }
+
+  c->sign = BIGNUM_POSITIVE;
+  bignum_resize(c, n);
+  memcpy(c->digit, r, sizeof(word) * n);
+  bignum_normalize(c);
+
+  bignum_scratch_restore(mark);
+}
+
+/* mu = BIGNUM_BASE^(2n) / m (n + 2 digits, the top one set only for m = BIGNUM_BASE^(n-1)). */
+static void
+bignum_barrett_inverse(word *mu, const word *m, int n)
+{
+  bignum_scratch_mark mark;
+  word *u, *r;
+
+  mark = bignum_scratch_save();
+  u = bignum_scratch_alloc(sizeof(word) * (2 * n + 1));
+  r = bignum_scratch_alloc(sizeof(word) * n);
+  memset(u, 0, sizeof(word) * 2 * n);
+  u[2 * n] = 1;
+  bignum_divrem_digits(mu, r, u, 2 * n + 1, m, n);
+  bignum_scratch_restore(mark);
+}
+
+/* Digits of the temporary passed to bignum_barrett_reduce. */
+static int
+bignum_barrett_scratch_size(int n)
+{
+  return (2 * n + 3) + (2 * n + 2) + (n + 1) + bignum_mul_scratch_size(n + 2);
+}
+
+/*
+ * r = x mod m for x < BIGNUM_BASE^(2n) (nx <= 2n digits), where m has n digits
+ * and mu comes from bignum_barrett_inverse. The quotient estimate
+ * (x / BIGNUM_BASE^(n-1)) * mu / BIGNUM_BASE^(n+1) is at most two below the
+ * true one (HAC, algorithm 14.42), so x minus its product with m needs only
+ * the low n + 1 digits and a few corrections. Small moduli use truncated
+ * schoolbook products, larger ones the full multiplication.
+ */
+static void
+bignum_barrett_reduce(word *r, const word *x, int nx, const word *m, int n,
+                      const word *mu, word *t)
+{
+  word *q2, *p, *w, *scratch;
+  const word *q1, *q3;
+  int nmu, k1, k3;
+
+  assert(nx <= 2 * n);
+
+  if (nx < n) {
+    memcpy(r, x, sizeof(word) * nx);
+    memset(r + nx, 0, sizeof(word) * (n - nx));
+    return;
+  }
+
+  nmu = mu[n + 1] != 0 ? n + 2 : n + 1;
+  q2 = t;
+  p = q2 + 2 * n + 3;
+  w = p + 2 * n + 2;
+  scratch = w + n + 1;
+
+  q1 = x + n - 1;
+  k1 = nx - n + 1;
+  q3 = q2 + n + 1;
+  k3 = k1 + nmu - n - 1;
+
+  if (n < BIGNUM_BARRETT_SHORT_THRESHOLD) {
+    /* Only the digits the result depends on: the columns of q1 * mu from n - 1
+       up, which lowers the estimate by at most one more, and the low n + 1
+       digits of q3 * m. */
+    memset(q2, 0, sizeof(word) * (k1 + nmu));
+    for (int i = 0; i < k1; i++) {
+      int j = MAX(n - 1 - i, 0);
+      q2[i + nmu] = bignum_addmul_1(q2 + i + j, mu + j, nmu - j, q1[i]);
+    }
+
+    memset(p, 0, sizeof(word) * (n + 1));
+    for (int i = 0; i < k3 && i <= n; i++) {
+      int len = MIN(n, n + 1 - i);
+      word c = bignum_addmul_1(p + i, m, len, q3[i]);
+      if (i + len <= n) {
+        p[i + len] = c;
+      }
+    }
+  } else {
+    bignum_mul_digits(q2, mu, nmu, q1, k1, scratch);
+    if (k3 >= n) {
+      bignum_mul_digits(p, q3, k3, m, n, scratch);
+    } else {
+      bignum_mul_digits(p, m, n, q3, k3, scratch);
+    }
+  }
+
+  /* The difference is below 3m, which fits n + 1 digits. */
+  memcpy(w, x, sizeof(word) * MIN(nx, n + 1));
+  if (nx < n + 1) {
+    w[n] = 0;
+  }
+  bignum_sub_n(w, w, p, n + 1);
+
+  while (w[n] != 0 || bignum_cmp_digits(w, n, m, n) >= 0) {
+    w[n] -= bignum_sub_n(w, w, m, n);
+  }
+
+  memcpy(r, w, sizeof(word) * n);
+}
+
+/* Window size minimizing the multiplications for an exponent of bits bits. */
+static int
+bignum_pow_window(int bits)
+{
+  if (bits <= 8) {
+    return 1;
+  } else if (bits <= 24) {
+    return 2;
+  } else if (bits <= 80) {
+    return 3;
+  } else if (bits <= 240) {
+    return 4;
+  } else if (bits <= 672) {
+    return 5;
+  }
+  return 6;
+}
+
+void
+bignum_neg(const bignum *a, bignum *b)
+{
+  int size, neg;
+
+  assert(a != NULL && b != NULL);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_BITWISE, a->size);
+
+  size = a->size;
+  neg = a->sign == BIGNUM_NEGATIVE;
+
+  /* ~a = -(a + 1), so the magnitude grows by one for a >= 0 and shrinks by one
+     for a < 0. */
+  b->sign = BIGNUM_POSITIVE;
+  bignum_resize(b, size + 1);
+  if (neg) {
+    bignum_sub_1(b->digit, a->digit, size, 1);
+    b->digit[size] = 0;
+  } else {
+    b->digit[size] = bignum_add_1(b->digit, a->digit, size, 1);
+  }
+
+  bignum_normalize(b);
+  bignum_set_sign(b, neg ? BIGNUM_POSITIVE : BIGNUM_NEGATIVE);
+}
+
+void
+bignum_or(const bignum *a, const bignum *b, bignum *c)
+{
+  assert(a != NULL && b != NULL && c != NULL);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_BITWISE, a->size + b->size);
+
+  bignum_bitwise_op(a, b, c, '|');
+}
+
+void
+bignum_xor(const bignum *a, const bignum *b, bignum *c)
+{
+  assert(a != NULL && b != NULL && c != NULL);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_BITWISE, a->size + b->size);
+
+  bignum_bitwise_op(a, b, c, '^');
+}
+
+void
+bignum_and(const bignum *a, const bignum *b, bignum *c)
+{
+  assert(a != NULL && b != NULL && c != NULL);
+  BIGNUM_STAT_CALL(BIGNUM_STATS_BITWISE, a->size + b->size);
+
+  bignum_bitwise_op(a, b, c, '&');
+}
+
+/*
+ * Perform bitwise OR XOR AND in one pass over the digits. A negative operand
+ * is read as its two's complement ~|x| + 1, formed digit by digit with a
+ * running carry, and a negative result is turned back into a magnitude the
+ * same way. One extra digit holds the sign extension, which also covers the
+ * magnitude B^size. The operands are not modified, and c may be one of them
+ * because digit i is written after it is read.
+ *
+ * The carries die at the first nonzero digit, after which every digit is a
+ * plain ((x ^ mask_a) op (y ^ mask_b)) ^ mask_r, left to bignum_bitwise_n.
+ * OR goes there as AND of the complements.
+ */
+static void
+bignum_bitwise_op(const bignum *a, const bignum *b, bignum *c, char op)
+{
+  int size_a, size_b, neg_a, neg_b, neg_r, i;
+  word mask_a, mask_b, mask_r, x, y, z;
+  dword carry_a, carry_b, carry_r;
+
+  size_a = a->size;
+  size_b = b->size;
+
+  if (size_a < size_b) {
+    { const bignum *tmp = a; a = b; b = tmp; }
+    { int tmp = size_a; size_a = size_b; size_b = tmp; }
+  }
+
+  neg_a = a->sign == BIGNUM_NEGATIVE;
+  neg_b = b->sign == BIGNUM_NEGATIVE;
+
+  switch (op) {
+    case '|':
+      neg_r = neg_a | neg_b;
+    break;
+    case '^':
+      neg_r = neg_a ^ neg_b;
+    break;
+    default:
+      neg_r = neg_a & neg_b;
+    break;
+  }
+
+  /* The complement is x ^ mask plus the carry, which is the identity for a
+     non-negative number. */
+  mask_a = neg_a ? BIGNUM_MASK : 0;
+  mask_b = neg_b ? BIGNUM_MASK : 0;
+  mask_r = neg_r ? BIGNUM_MASK : 0;
+  carry_a = neg_a;
+  carry_b = neg_b;
+  carry_r = neg_r;
+
+  c->sign = BIGNUM_POSITIVE;
+  bignum_resize(c, size_a + 1);
+
+  for (i = 0; i <= size_a && (carry_a | carry_b | carry_r) != 0; i++) {
+    x = i < size_a ? a->digit[i] : 0;
+    y = i < size_b ? b->digit[i] : 0;
+
+    carry_a += (word)(x ^ mask_a);
+    x = (word)carry_a;
+    carry_a >>= BIGNUM_SHIFT;
+
+    carry_b += (word)(y ^ mask_b);
+    y = (word)carry_b;
+    carry_b >>= BIGNUM_SHIFT;
+
+    switch (op) {
+      case '|':
+        z = x | y;
+      break;
+      case '^':
+        z = x ^ y;
+      break;
+      default:
+        z = x & y;
+      break;
+    }
+
+    carry_r += (word)(z ^ mask_r);
+    c->digit[i] = (word)carry_r;
+    carry_r >>= BIGNUM_SHIFT;
+  }
+
+  if (op == '|') {
+    mask_a = ~mask_a;
+    mask_b = ~mask_b;
+    mask_r = ~mask_r;
+  }
+
+  if (i < size_b) {
+    bignum_bitwise_n(c->digit + i, a->digit + i, b->digit + i, size_b - i, mask_a, mask_b,
+                     mask_r, op != '^');
+    i = size_b;
+  }
+  if (i < size_a) {
+    bignum_bitwise_n(c->digit + i, a->digit + i, NULL, size_a - i, mask_a, mask_b, mask_r,
+                     op != '^');
+    i = size_a;
+  }
+  if (i == size_a) {
+    z = op != '^' ? mask_a & mask_b : mask_a ^ mask_b;
+    c->digit[i] = z ^ mask_r;
+  }
+
+  bignum_normalize(c);
+  bignum_set_sign(c, neg_r ? BIGNUM_NEGATIVE : BIGNUM_POSITIVE);
+}
+
+/*
+ * Set up t (not initialized) as the value of b with the given sign, in its
+ * inline digits.
+ */
+static void
+bignum_init_u64(bignum *t, uint64_t b, int sign)
+{
+  bignum_init(t);
+
+#if BIGNUM_SHIFT == 64
+  t->digit[0] = b;
+#else
+  t->size = 0;
+  do {
+    t->digit[t->size++] = (word)b;
+    b >>= BIGNUM_SHIFT;
+  } while (b != 0);
+#endif
+  bignum_set_sign(t, sign);
+}
+
+static int
+bignum_is_zero(const bignum *a)
+{
+  return a->size == 1 && a->digit[0] == 0;
+}
+
+static void
+bignum_set_sign(bignum *a, int sign)
+{
+  a->sign = bignum_is_zero(a) == 1 ? BIGNUM_POSITIVE : sign;
+}
+
+static int
+bignum_bit_length(word x)
+{
+  int length = 0;
+  while (x > 0) {
+    length++;
+    x >>= 1;  /* Right shift with zero-extend. */
+  }
+  return length;
+}
+
+static bignum *
+bignum_normalize(bignum *a)
+{
+  while (a->size - 1 > 0 && a->digit[a->size - 1] == 0) {
+    a->size--;
+  }
+  return a;
+}
+
+
+/*
+ * CPU features of the x86 kernels, detected on first use and cached. The
+ * relaxed atomics only keep concurrent first calls from racing.
+ */
+#if defined(BIGNUM_X86_SIMD) || defined(BIGNUM_X86_ADX)
+static int bignum_cpu = -1;
+
+static int
+bignum_cpu_detect(void)
+{
+  int f = 0;
+
+#ifdef BIGNUM_X86_SIMD
+#  ifndef BIGNUM_NO_AVX512
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    f |= BIGNUM_CPU_AVX512;
+  }
+#  endif
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2")) {
+    f |= BIGNUM_CPU_AVX2;
+  }
+#endif
+#ifdef BIGNUM_X86_ADX
+  if (__builtin_cpu_supports("bmi2") && __builtin_cpu_supports("adx")) {
+    f |= BIGNUM_CPU_ADX;
+  }
+#endif
+  return f;
+}
+
+static int
+bignum_cpu_features(void)
+{
+  int f = __atomic_load_n(&bignum_cpu, __ATOMIC_RELAXED);
+
+  if (f < 0) {
+    f = bignum_cpu_detect();
+    __atomic_store_n(&bignum_cpu, f, __ATOMIC_RELAXED);
+  }
+  return f;
+}
+#endif
+
+int
+bignum_set_cpu_features(int mask)
+{
+#if defined(BIGNUM_X86_SIMD) || defined(BIGNUM_X86_ADX)
+  int f = bignum_cpu_detect() & mask;
+
+  __atomic_store_n(&bignum_cpu, f, __ATOMIC_RELAXED);
+  return f;
+#else
+  (void)mask;
+  return 0;
+#endif
+}
+
+/*
+ * x86 vector kernels, chosen at run time by bignum_simd_level. Carries cross
+ * the lanes by carry-lookahead on lane bit masks: with G the lanes whose sum
+ * wraps and P the lanes that are all ones, the lanes receiving a carry are
+ * (P + (G << 1 | carry_in)) ^ P and the bit above the lanes is the carry out.
+ * Subtraction is the same with borrows and all-zero lanes.
+ */
+#ifdef BIGNUM_X86_SIMD
+
+#define BIGNUM_SIMD_NONE 0
+#define BIGNUM_SIMD_AVX2 1
+#define BIGNUM_SIMD_AVX512 2
+
+/* Shorter arrays are not worth the dispatch. */
+#define BIGNUM_SIMD_MIN_DIGITS 16
+
+static int
+bignum_simd_level(void)
+{
+  int f = bignum_cpu_features();
+
+  if (f & BIGNUM_CPU_AVX512) {
+    return BIGNUM_SIMD_AVX512;
+  }
+  if (f & BIGNUM_CPU_AVX2) {
+    return BIGNUM_SIMD_AVX2;
+  }
+  return BIGNUM_SIMD_NONE;
+}
+
+#if BIGNUM_SHIFT == 64
+#  define BIGNUM_V256_LANES 4
+#  define BIGNUM_V256_ADD _mm256_add_epi64
+#  define BIGNUM_V256_SUB _mm256_sub_epi64
+#  define BIGNUM_V256_EQ _mm256_cmpeq_epi64
+#  define BIGNUM_V256_SET1(x) _mm256_set1_epi64x((long long)(x))
+#  define BIGNUM_V256_LANE_BITS _mm256_setr_epi64x(1, 2, 4, 8)
+#  define BIGNUM_V256_MOVEMASK(v) (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(v))
+/* x >= y unsigned, by a signed compare with the sign bits flipped. */
+#  define BIGNUM_V256_GE(x, y) \
+  _mm256_xor_si256(_mm256_cmpgt_epi64(_mm256_xor_si256(y, sign), _mm256_xor_si256(x, sign)), ones)
+#  define BIGNUM_V512_LANES 8
+#  define BIGNUM_V512_ADD _mm512_add_epi64
+#  define BIGNUM_V512_SUB _mm512_sub_epi64
+#  define BIGNUM_V512_SET1(x) _mm512_set1_epi64((long long)(x))
+#  define BIGNUM_V512_MASK_ADD _mm512_mask_add_epi64
+#  define BIGNUM_V512_MASK_SUB _mm512_mask_sub_epi64
+#  define BIGNUM_V512_LT_MASK _mm512_cmplt_epu64_mask
+#  define BIGNUM_V512_EQ_MASK _mm512_cmpeq_epi64_mask
+#elif BIGNUM_SHIFT == 32
+#  define BIGNUM_V256_LANES 8
+#  define BIGNUM_V256_ADD _mm256_add_epi32
+#  define BIGNUM_V256_SUB _mm256_sub_epi32
+#  define BIGNUM_V256_EQ _mm256_cmpeq_epi32
+#  define BIGNUM_V256_SET1(x) _mm256_set1_epi32((int)(x))
+#  define BIGNUM_V256_LANE_BITS _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128)
+#  define BIGNUM_V256_MOVEMASK(v) (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(v))
+#  define BIGNUM_V256_GE(x, y) _mm256_cmpeq_epi32(_mm256_max_epu32(x, y), x)
+#  define BIGNUM_V512_LANES 16
+#  define BIGNUM_V512_ADD _mm512_add_epi32
+#  define BIGNUM_V512_SUB _mm512_sub_epi32
+#  define BIGNUM_V512_SET1(x) _mm512_set1_epi32((int)(x))
+#  define BIGNUM_V512_MASK_ADD _mm512_mask_add_epi32
+#  define BIGNUM_V512_MASK_SUB _mm512_mask_sub_epi32
+#  define BIGNUM_V512_LT_MASK _mm512_cmplt_epu32_mask
+#  define BIGNUM_V512_EQ_MASK _mm512_cmpeq_epi32_mask
+#else
+#  define BIGNUM_V256_LANES 16
+#  define BIGNUM_V256_ADD _mm256_add_epi16
+#  define BIGNUM_V256_SUB _mm256_sub_epi16
+#  define BIGNUM_V256_EQ _mm256_cmpeq_epi16
+#  define BIGNUM_V256_SET1(x) _mm256_set1_epi16((short)(x))
+#  define BIGNUM_V256_LANE_BITS \
+  _mm256_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, \
+                    (short)32768)
+/* The byte mask has two bits per lane. */
+#  define BIGNUM_V256_MOVEMASK(v) _pext_u32((unsigned)_mm256_movemask_epi8(v), 0x55555555U)
+#  define BIGNUM_V256_GE(x, y) _mm256_cmpeq_epi16(_mm256_max_epu16(x, y), x)
+#  define BIGNUM_V512_LANES 32
+#  define BIGNUM_V512_ADD _mm512_add_epi16
+#  define BIGNUM_V512_SUB _mm512_sub_epi16
+#  define BIGNUM_V512_SET1(x) _mm512_set1_epi16((short)(x))
+#  define BIGNUM_V512_MASK_ADD _mm512_mask_add_epi16
+#  define BIGNUM_V512_MASK_SUB _mm512_mask_sub_epi16
+#  define BIGNUM_V512_LT_MASK _mm512_cmplt_epu16_mask
+#  define BIGNUM_V512_EQ_MASK _mm512_cmpeq_epi16_mask
+#endif
+
+#define BIGNUM_V256_ALL ((1U << BIGNUM_V256_LANES) - 1)
+#define BIGNUM_V512_ALL ((uint64_t)(((uint64_t)1 << BIGNUM_V512_LANES) - 1))
+
+/* The lanes of a vector whose bit is set in m, as all ones. */
+#define BIGNUM_V256_EXPAND(m) \
+  BIGNUM_V256_EQ(_mm256_and_si256(BIGNUM_V256_SET1(m), lane_bits), lane_bits)
+
+__attribute__((target("avx2,bmi2")))
+static word
+bignum_add_n_avx2(word *r, const word *a, const word *b, int n)
+{
+  const __m256i ones = _mm256_set1_epi32(-1);
+  const __m256i lane_bits = BIGNUM_V256_LANE_BITS;
+#if BIGNUM_SHIFT == 64
+  const __m256i sign = _mm256_set1_epi64x(LLONG_MIN);
+#endif
+  unsigned carry = 0, g, p, t;
+  dword c;
+  int i;
+
+  for (i = 0; i + BIGNUM_V256_LANES <= n; i += BIGNUM_V256_LANES) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i s = BIGNUM_V256_ADD(x, _mm256_loadu_si256((const __m256i *)(b + i)));
+
+    g = ~BIGNUM_V256_MOVEMASK(BIGNUM_V256_GE(s, x)) & BIGNUM_V256_ALL;
+    p = BIGNUM_V256_MOVEMASK(BIGNUM_V256_EQ(s, ones));
+    t = p + (g << 1 | carry);
+    carry = t >> BIGNUM_V256_LANES;
+    t = (t ^ p) & BIGNUM_V256_ALL;
+
+    /* Subtracting all ones adds one. */
+    s = BIGNUM_V256_SUB(s, BIGNUM_V256_EXPAND(t));
+    _mm256_storeu_si256((__m256i *)(r + i), s);
+  }
+
+  for (c = carry; i < n; i++) {
+    c += (dword)a[i] + (dword)b[i];
+    r[i] = c & BIGNUM_MASK;
+    c >>= BIGNUM_SHIFT;
+  }
+  return (word)c;
+}
+
+__attribute__((target("avx2,bmi2")))
+static word
+bignum_sub_n_avx2(word *r, const word *a, const word *b, int n)
+{
+  const __m256i lane_bits = BIGNUM_V256_LANE_BITS;
+#if BIGNUM_SHIFT == 64
+  const __m256i ones = _mm256_set1_epi32(-1);
+  const __m256i sign = _mm256_set1_epi64x(LLONG_MIN);
+#endif
+  unsigned borrow = 0, g, p, t;
+  dword c;
+  int i;
+
+  for (i = 0; i + BIGNUM_V256_LANES <= n; i += BIGNUM_V256_LANES) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+    __m256i d = BIGNUM_V256_SUB(x, y);
+
+    g = ~BIGNUM_V256_MOVEMASK(BIGNUM_V256_GE(x, y)) & BIGNUM_V256_ALL;
+    p = BIGNUM_V256_MOVEMASK(BIGNUM_V256_EQ(d, _mm256_setzero_si256()));
+    t = p + (g << 1 | borrow);
+    borrow = t >> BIGNUM_V256_LANES;
+    t = (t ^ p) & BIGNUM_V256_ALL;
+
+    d = BIGNUM_V256_ADD(d, BIGNUM_V256_EXPAND(t));
+    _mm256_storeu_si256((__m256i *)(r + i), d);
+  }
+
+  for (c = borrow; i < n; i++) {
+    c = BIGNUM_BASE + (dword)a[i] - (dword)b[i] - c;
+    r[i] = c & BIGNUM_MASK;
+    c = c < BIGNUM_BASE;
+  }
+  return (word)c;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static word
+bignum_add_n_avx512(word *r, const word *a, const word *b, int n)
+{
+  const __m512i ones = _mm512_set1_epi32(-1);
+  uint64_t carry = 0, g, p, t;
+  dword c;
+  int i;
+
+  for (i = 0; i + BIGNUM_V512_LANES <= n; i += BIGNUM_V512_LANES) {
+    __m512i x = _mm512_loadu_si512(a + i);
+    __m512i s = BIGNUM_V512_ADD(x, _mm512_loadu_si512(b + i));
+
+    g = BIGNUM_V512_LT_MASK(s, x);
+    p = BIGNUM_V512_EQ_MASK(s, ones);
+    t = p + (g << 1 | carry);
+    carry = t >> BIGNUM_V512_LANES;
+    t = (t ^ p) & BIGNUM_V512_ALL;
+
+    s = BIGNUM_V512_MASK_SUB(s, t, s, ones);
+    _mm512_storeu_si512(r + i, s);
+  }
+
+  for (c = carry; i < n; i++) {
+    c += (dword)a[i] + (dword)b[i];
+    r[i] = c & BIGNUM_MASK;
+    c >>= BIGNUM_SHIFT;
+  }
+  return (word)c;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static word
+bignum_sub_n_avx512(word *r, const word *a, const word *b, int n)
+{
+  const __m512i ones = _mm512_set1_epi32(-1);
+  uint64_t borrow = 0, g, p, t;
+  dword c;
+  int i;
+
+  for (i = 0; i + BIGNUM_V512_LANES <= n; i += BIGNUM_V512_LANES) {
+    __m512i x = _mm512_loadu_si512(a + i);
+    __m512i y = _mm512_loadu_si512(b + i);
+    __m512i d = BIGNUM_V512_SUB(x, y);
+
+    g = BIGNUM_V512_LT_MASK(x, y);
+    p = BIGNUM_V512_EQ_MASK(d, _mm512_setzero_si512());
+    t = p + (g << 1 | borrow);
+    borrow = t >> BIGNUM_V512_LANES;
+    t = (t ^ p) & BIGNUM_V512_ALL;
+
+    d = BIGNUM_V512_MASK_ADD(d, t, d, ones);
+    _mm512_storeu_si512(r + i, d);
+  }
+
+  for (c = borrow; i < n; i++) {
+    c = BIGNUM_BASE + (dword)a[i] - (dword)b[i] - c;
+    r[i] = c & BIGNUM_MASK;
+    c = c < BIGNUM_BASE;
+  }
+  return (word)c;
+}
+
+/* See bignum_bitwise_n. */
+__attribute__((target("avx2")))
+static void
+bignum_bitwise_n_avx2(word *r, const word *a, const word *b, int n, word mask_a, word mask_b,
+                      word mask_r, int is_and)
+{
+  const __m256i ma = BIGNUM_V256_SET1(mask_a);
+  const __m256i mb = BIGNUM_V256_SET1(mask_b);
+  const __m256i mr = BIGNUM_V256_SET1(mask_r);
+  __m256i x, y;
+  int i;
+
+  for (i = 0; i + BIGNUM_V256_LANES <= n; i += BIGNUM_V256_LANES) {
+    x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)), ma);
+    y = b != NULL ? _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(b + i)), mb) : mb;
+    x = is_and ? _mm256_and_si256(x, y) : _mm256_xor_si256(x, y);
+    _mm256_storeu_si256((__m256i *)(r + i), _mm256_xor_si256(x, mr));
+  }
+
+  for (; i < n; i++) {
+    word w = (b != NULL ? b[i] : 0) ^ mask_b;
+    r[i] = (is_and ? (a[i] ^ mask_a) & w : (a[i] ^ mask_a) ^ w) ^ mask_r;
+  }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void
+bignum_bitwise_n_avx512(word *r, const word *a, const word *b, int n, word mask_a,
+                        word mask_b, word mask_r, int is_and)
+{
+  const __m512i ma = BIGNUM_V512_SET1(mask_a);
+  const __m512i mb = BIGNUM_V512_SET1(mask_b);
+  const __m512i mr = BIGNUM_V512_SET1(mask_r);
+  __m512i x, y;
+  int i;
+
+  for (i = 0; i + BIGNUM_V512_LANES <= n; i += BIGNUM_V512_LANES) {
+    x = _mm512_xor_si512(_mm512_loadu_si512(a + i), ma);
+    y = b != NULL ? _mm512_xor_si512(_mm512_loadu_si512(b + i), mb) : mb;
+    x = is_and ? _mm512_and_si512(x, y) : _mm512_xor_si512(x, y);
+    _mm512_storeu_si512(r + i, _mm512_xor_si512(x, mr));
+  }
+
+  for (; i < n; i++) {
+    word w = (b != NULL ? b[i] : 0) ^ mask_b;
+    r[i] = (is_and ? (a[i] ^ mask_a) & w : (a[i] ^ mask_a) ^ w) ^ mask_r;
+  }
+}
+
+#endif  /* BIGNUM_X86_SIMD */
+
+static word
+bignum_add_n(word *r, const word *a, const word *b, int n)
+{
+  dword carry = 0;
+
+#ifdef BIGNUM_X86_SIMD
+  if (n >= BIGNUM_SIMD_MIN_DIGITS) {
+    switch (bignum_simd_level()) {
+      case BIGNUM_SIMD_AVX512:
+        return bignum_add_n_avx512(r, a, b, n);
+      case BIGNUM_SIMD_AVX2:
+        return bignum_add_n_avx2(r, a, b, n);
+    }
+  }
+#endif
+
+  for (int i = 0; i < n; i++) {
+    carry += (dword)a[i] + (dword)b[i];
+    r[i] = carry & BIGNUM_MASK;
+    carry >>= BIGNUM_SHIFT;
+  }
+  return (word)carry;
+}
+
+static word
+bignum_sub_n(word *r, const word *a, const word *b, int n)
+{
+  dword borrow = 0;
+
+#ifdef BIGNUM_X86_SIMD
+  if (n >= BIGNUM_SIMD_MIN_DIGITS) {
+    switch (bignum_simd_level()) {
+      case BIGNUM_SIMD_AVX512:
+        return bignum_sub_n_avx512(r, a, b, n);
+      case BIGNUM_SIMD_AVX2:
+        return bignum_sub_n_avx2(r, a, b, n);
+    }
+  }
+#endif
+
+  for (int i = 0; i < n; i++) {
+    borrow = BIGNUM_BASE + (dword)a[i] - (dword)b[i] - borrow;
+    r[i] = borrow & BIGNUM_MASK;
+    borrow = borrow < BIGNUM_BASE;
+  }
+  return (word)borrow;
+}
+
+/*
+ * r[i] = ((a[i] ^ mask_a) & (b[i] ^ mask_b)) ^ mask_r, or with ^ in place of &
+ * when is_and is 0. A NULL b reads as zeros.
+ */
+static void
+bignum_bitwise_n(word *r, const word *a, const word *b, int n, word mask_a, word mask_b,
+                 word mask_r, int is_and)
+{
+  word w;
+
+#ifdef BIGNUM_X86_SIMD
+  if (n >= BIGNUM_SIMD_MIN_DIGITS) {
+    switch (bignum_simd_level()) {
+      case BIGNUM_SIMD_AVX512:
+        bignum_bitwise_n_avx512(r, a, b, n, mask_a, mask_b, mask_r, is_and);
+        return;
+      case BIGNUM_SIMD_AVX2:
+        bignum_bitwise_n_avx2(r, a, b, n, mask_a, mask_b, mask_r, is_and);
+        return;
+    }
+  }
+#endif
+
+  for (int i = 0; i < n; i++) {
+    w = (b != NULL ? b[i] : 0) ^ mask_b;
+    r[i] = (is_and ? (a[i] ^ mask_a) & w : (a[i] ^ mask_a) ^ w) ^ mask_r;
+  }
+}
+
+/*
+ * r = a + b, where a has n digits. Return the carry.
+ */
+static word
+bignum_add_1(word *r, const word *a, int n, word b)
+{
+  dword carry = b;
+  int i;
+
+  for (i = 0; i < n && carry > 0; i++) {
+    carry += (dword)a[i];
+    r[i] = carry & BIGNUM_MASK;
+    carry >>= BIGNUM_SHIFT;
+  }
+  if (r != a) {
+    for (; i < n; i++) {
+      r[i] = a[i];
+    }
+  }
+  return (word)carry;
+}
+
+/*
+ * r = a - b, where a has n digits. Return the borrow.
+ */
+static word
+bignum_sub_1(word *r, const word *a, int n, word b)
+{
+  dword borrow = b;
+  int i;
+
+  for (i = 0; i < n && borrow > 0; i++) {
+    borrow = BIGNUM_BASE + (dword)a[i] - borrow;
+    r[i] = borrow & BIGNUM_MASK;
+    borrow = borrow < BIGNUM_BASE;
+  }
+  if (r != a) {
+    for (; i < n; i++) {
+      r[i] = a[i];
+    }
+  }
+  return (word)borrow;
+}
+
+/*
+ * r = a + b, na >= nb. r has na digits. Return the carry.
+ */
+static word
+bignum_add_digits(word *r, const word *a, int na, const word *b, int nb)
+{
+  word carry = bignum_add_n(r, a, b, nb);
+  return bignum_add_1(r + nb, a + nb, na - nb, carry);
+}
+
+/*
+ * r = a - b, na >= nb. r has na digits. Return the borrow.
+ */
+static word
+bignum_sub_digits(word *r, const word *a, int na, const word *b, int nb)
+{
+  word borrow = bignum_sub_n(r, a, b, nb);
+  return bignum_sub_1(r + nb, a + nb, na - nb, borrow);
+}
+
+/*
+ * r += a in place, where the sum is known to fit in nr digits. Leading zeros
+ * of a beyond nr are ignored.
+ */
+static void
+bignum_add_into(word *r, int nr, const word *a, int na)
+{
+  word carry;
+
+  while (na > nr) {
+    assert(a[na - 1] == 0);
+    na--;
+  }
+
+  carry = bignum_add_digits(r, r, nr, a, na);
+  assert(carry == 0);
+  (void)carry;
+}
+
+/*
+ * Compare a (na digits) with b (nb digits). Leading zeros are allowed.
+ */
+static int
+bignum_cmp_digits(const word *a, int na, const word *b, int nb)
+{
+  for (; na > nb; na--) {
+    if (a[na - 1] != 0) {
+      return 1;
+    }
+  }
+  for (; nb > na; nb--) {
+    if (b[nb - 1] != 0) {
+      return -1;
+    }
+  }
+  while (--na >= 0) {
+    if (a[na] != b[na]) {
+      return a[na] > b[na] ? 1 : -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * r = |a - b|, na >= nb. r has na digits. Return 1 if a < b, 0 otherwise.
+ */
+static int
+bignum_sub_abs(word *r, const word *a, int na, const word *b, int nb)
+{
+  if (bignum_cmp_digits(a, na, b, nb) >= 0) {
+    bignum_sub_digits(r, a, na, b, nb);
+    return 0;
+  }
+
+  /* a < b, so the digits of a above nb are zeros. */
+  bignum_sub_n(r, b, a, nb);
+  memset(r + nb, 0, sizeof(word) * (na - nb));
+  return 1;
+}
+
+/*
+ * r = a << s, 0 < s < BIGNUM_SHIFT. Return the bits shifted out.
+ */
+static word
+bignum_lshift_digits(word *r, const word *a, int n, int s)
+{
+  word carry = 0;
+
+  for (int i = 0; i < n; i++) {
+    dword acc = ((dword)a[i] << s) | carry;
+    r[i] = (word)(acc & BIGNUM_MASK);
+    carry = (word)(acc >> BIGNUM_SHIFT);
+  }
+  return carry;
+}
+
+/*
+ * r = a >> s, 0 < s < BIGNUM_SHIFT. Return the bits shifted out (in the high
+ * bits of the result).
+ */
+static word
+bignum_rshift_digits(word *r, const word *a, int n, int s)
+{
+  word carry = 0;
+
+  for (int i = n - 1; i >= 0; i--) {
+    dword acc = ((dword)a[i] << BIGNUM_SHIFT) >> s;
+    r[i] = (word)(acc >> BIGNUM_SHIFT) | carry;
+    carry = (word)(acc & BIGNUM_MASK);
+  }
+  return carry;
+}
+
+/*
+ * x86-64 kernels for 64-bit digits with BMI2 mulx and the two independent
+ * carry chains of ADX: adcx sums the product halves on CF while adox adds
+ * r on OF. The loops take four digits at a time and leave the rest to the
+ * callers; lea and jrcxz keep the flags intact between iterations.
+ */
+#ifdef BIGNUM_X86_ADX
+
+static int
+bignum_adx_supported(void)
+{
+  return (bignum_cpu_features() & BIGNUM_CPU_ADX) != 0;
+}
+
+/* r = a * b, n a positive multiple of 4. Return the high digit. */
+static word
+bignum_mul_1_adx(word *r, const word *a, int n, word b)
+{
+  long i = -(long)n;
+  word c = 0, lo, hi, z;
+
+  __asm__("xor %k[z], %k[z]\n"
+          "1:\n\t"
+          "mulx (%[a],%[i],8), %[lo], %[hi]\n\t"
+          "adcx %[c], %[lo]\n\t"
+          "mov %[lo], (%[r],%[i],8)\n\t"
+          "mulx 8(%[a],%[i],8), %[lo], %[c]\n\t"
+          "adcx %[hi], %[lo]\n\t"
+          "mov %[lo], 8(%[r],%[i],8)\n\t"
+          "mulx 16(%[a],%[i],8), %[lo], %[hi]\n\t"
+          "adcx %[c], %[lo]\n\t"
+          "mov %[lo], 16(%[r],%[i],8)\n\t"
+          "mulx 24(%[a],%[i],8), %[lo], %[c]\n\t"
+          "adcx %[hi], %[lo]\n\t"
+          "mov %[lo], 24(%[r],%[i],8)\n\t"
+          "lea 4(%[i]), %[i]\n\t"
+          "jrcxz 2f\n\t"
+          "jmp 1b\n"
+          "2:\n\t"
+          "adcx %[z], %[c]"
+          : [c] "+&r" (c), [i] "+&c" (i), [lo] "=&r" (lo), [hi] "=&r" (hi), [z] "=&r" (z)
+          : [a] "r" (a + n), [r] "r" (r + n), "d" (b)
+          : "cc", "memory");
+  return c;
+}
+
+/* r += a * b, n a positive multiple of 4. Return the carry digit. */
+static word
+bignum_addmul_1_adx(word *r, const word *a, int n, word b)
+{
+  long i = -(long)n;
+  word c = 0, lo, hi, z;
+
+  __asm__("xor %k[z], %k[z]\n"
+          "1:\n\t"
+          "mulx (%[a],%[i],8), %[lo], %[hi]\n\t"
+          "adcx %[c], %[lo]\n\t"
+          "adox (%[r],%[i],8), %[lo]\n\t"
+          "mov %[lo], (%[r],%[i],8)\n\t"
+          "mulx 8(%[a],%[i],8), %[lo], %[c]\n\t"
+          "adcx %[hi], %[lo]\n\t"
+          "adox 8(%[r],%[i],8), %[lo]\n\t"
+          "mov %[lo], 8(%[r],%[i],8)\n\t"
+          "mulx 16(%[a],%[i],8), %[lo], %[hi]\n\t"
+          "adcx %[c], %[lo]\n\t"
+          "adox 16(%[r],%[i],8), %[lo]\n\t"
+          "mov %[lo], 16(%[r],%[i],8)\n\t"
+          "mulx 24(%[a],%[i],8), %[lo], %[c]\n\t"
+          "adcx %[hi], %[lo]\n\t"
+          "adox 24(%[r],%[i],8), %[lo]\n\t"
+          "mov %[lo], 24(%[r],%[i],8)\n\t"
+          "lea 4(%[i]), %[i]\n\t"
+          "jrcxz 2f\n\t"
+          "jmp 1b\n"
+          "2:\n\t"
+          "adcx %[z], %[c]\n\t"
+          "adox %[z], %[c]"
+          : [c] "+&r" (c), [i] "+&c" (i), [lo] "=&r" (lo), [hi] "=&r" (hi), [z] "=&r" (z)
+          : [a] "r" (a + n), [r] "r" (r + n), "d" (b)
+          : "cc", "memory");
+  return c;
+}
 
-    while (i >= 0 && a->digit[i] == b->digit[i]) {
-      i--;
-    }
+/*
+ * r -= a * b, n a positive multiple of 4. Return the borrow digit. The
+ * subtraction is r + ~p + 1 on the OF chain, so OF starts set and ends
+ * clear when there is a borrow.
+ */
+static word
+bignum_submul_1_adx(word *r, const word *a, int n, word b)
+{
+  long i = -(long)n;
+  word c = 0, lo, hi, z;
+  int of;
+
+  __asm__("xor %k[z], %k[z]\n\t"
+          "movabs $0x7fffffffffffffff, %[lo]\n\t"
+          "add $1, %[lo]\n"  /* OF = 1, CF = 0. */
+          "1:\n\t"
+          "mulx (%[a],%[i],8), %[lo], %[hi]\n\t"
+          "adcx %[c], %[lo]\n\t"
+          "not %[lo]\n\t"
+          "adox (%[r],%[i],8), %[lo]\n\t"
+          "mov %[lo], (%[r],%[i],8)\n\t"
+          "mulx 8(%[a],%[i],8), %[lo], %[c]\n\t"
+          "adcx %[hi], %[lo]\n\t"
+          "not %[lo]\n\t"
+          "adox 8(%[r],%[i],8), %[lo]\n\t"
+          "mov %[lo], 8(%[r],%[i],8)\n\t"
+          "mulx 16(%[a],%[i],8), %[lo], %[hi]\n\t"
+          "adcx %[c], %[lo]\n\t"
+          "not %[lo]\n\t"
+          "adox 16(%[r],%[i],8), %[lo]\n\t"
+          "mov %[lo], 16(%[r],%[i],8)\n\t"
+          "mulx 24(%[a],%[i],8), %[lo], %[c]\n\t"
+          "adcx %[hi], %[lo]\n\t"
+          "not %[lo]\n\t"
+          "adox 24(%[r],%[i],8), %[lo]\n\t"
+          "mov %[lo], 24(%[r],%[i],8)\n\t"
+          "lea 4(%[i]), %[i]\n\t"
+          "jrcxz 2f\n\t"
+          "jmp 1b\n"
+          "2:\n\t"
+          "adcx %[z], %[c]"
+          : [c] "+&r" (c), [i] "+&c" (i), [lo] "=&r" (lo), [hi] "=&r" (hi), [z] "=&r" (z),
+            "=@cco" (of)
+          : [a] "r" (a + n), [r] "r" (r + n), "d" (b)
+          : "cc", "memory");
+  return c + !of;
+}
 
-    if (i < 0) {
-      return bignum_new();  /* Numbers are equal. Return 0. */
-    }
+#endif  /* BIGNUM_X86_ADX */
 
-    if (a->digit[i] < b->digit[i]) {
-      { const bignum *tmp = a; a = b; b = tmp; }
-      sign = BIGNUM_NEGATIVE;
-    }
+/*
+ * r = a * b, where a has n digits. Return the high digit.
+ */
+static word
+bignum_mul_1(word *r, const word *a, int n, word b)
+{
+  dword carry = 0;
+  int i = 0;
 
-    size_a = size_b = i + 1;
+#ifdef BIGNUM_X86_ADX
+  if (n >= 4 && bignum_adx_supported()) {
+    i = n & ~3;
+    carry = bignum_mul_1_adx(r, a, i, b);
   }
+#endif
 
-  c = bignum_new();
-  c->sign = sign;
-  bignum_resize(c, size_a);
-
-  for (i = 0; i < size_b; i++) {
-    borrow = BIGNUM_BASE + (dword)a->digit[i] - (dword)b->digit[i] - borrow;
-    c->digit[i] = borrow & BIGNUM_MASK;
-    borrow = borrow < BIGNUM_BASE;
+  for (; i < n; i++) {
+    carry += (dword)a[i] * (dword)b;
+    r[i] = carry & BIGNUM_MASK;
+    carry >>= BIGNUM_SHIFT;
   }
+  return (word)carry;
+}
 
-  for (; i < size_a; i++) {
-    borrow = BIGNUM_BASE + (dword)a->digit[i] - borrow;
-    c->digit[i] = borrow & BIGNUM_MASK;
-    borrow = borrow < BIGNUM_BASE;
+/*
+ * r += a * b, where a has n digits. Return the high digit.
+ */
+static word
+bignum_addmul_1(word *r, const word *a, int n, word b)
+{
+  dword carry = 0;
+  int i = 0;
+
+#ifdef BIGNUM_X86_ADX
+  if (n >= 4 && bignum_adx_supported()) {
+    i = n & ~3;
+    carry = bignum_addmul_1_adx(r, a, i, b);
   }
+#endif
 
-  assert(borrow == 0);
-  return bignum_normalize(c);
+  for (; i < n; i++) {
+    carry += (dword)r[i] + (dword)a[i] * (dword)b;
+    r[i] = carry & BIGNUM_MASK;
+    carry >>= BIGNUM_SHIFT;
+  }
+  return (word)carry;
 }
 
 /*
- * Primary school multiplication.
+ * r -= a * b, where a has n digits. Return the borrow digit.
  */
-static bignum *
-bignum_mul_a(const bignum *a, const bignum *b)
+static word
+bignum_submul_1(word *r, const word *a, int n, word b)
 {
-  int size_a, size_b;
   dword carry = 0;
-  bignum *c;
+  int i = 0;
 
-  size_a = a->size;
-  size_b = b->size;
+#ifdef BIGNUM_X86_ADX
+  if (n >= 4 && bignum_adx_supported()) {
+    i = n & ~3;
+    carry = bignum_submul_1_adx(r, a, i, b);
+  }
+#endif
 
-  c = bignum_new();
-  bignum_resize(c, size_a + size_b);
+  for (; i < n; i++) {
+    word lo, x;
 
-  for (int i = 0; i < size_a; i++) {
-    for (int j = 0; j < size_b; j++) {
-      carry += (dword)c->digit[i + j] + (dword)a->digit[i] * (dword)b->digit[j];
-      c->digit[i + j] = carry & BIGNUM_MASK;
-      carry >>= BIGNUM_SHIFT;
-    }
-    c->digit[i + size_b] += carry & BIGNUM_MASK;
+    carry += (dword)a[i] * (dword)b;
+    lo = (word)(carry & BIGNUM_MASK);
     carry >>= BIGNUM_SHIFT;
 
-    assert(carry == 0);
+    x = r[i];
+    r[i] = (word)(x - lo);
+    carry += x < lo;
   }
-
-  return bignum_normalize(c);
+  return (word)carry;
 }
 
-static bignum *
-bignum_div_a(const bignum *a, const bignum *b)
+/*
+ * v = floor((BIGNUM_BASE^2 - 1) / d) - BIGNUM_BASE for a normalized d (top bit
+ * set), the reciprocal of Moller and Granlund, "Improved division by invariant
+ * integers".
+ */
+static word
+bignum_inverse_1(word d)
 {
-  if (b->size == 1) {
-    return bignum_div_a1(a, b);
-  }
-
-  if (a->size < b->size) {
-    return bignum_new();  /* Return 0. */
-  }
+  assert(d >> (BIGNUM_SHIFT - 1) == 1);
 
-  return bignum_div_a2(a, b);
+  return (word)(((dword)(word)~d << BIGNUM_SHIFT | BIGNUM_MASK) / d);
 }
 
 /*
- * Linear time division. Assuming length of b is 1.
+ * (u1 * BIGNUM_BASE + u0) / d with u1 < d, d normalized and v its
+ * bignum_inverse_1, by one multiplication and at most two corrections.
+ * Return the quotient and store the remainder in r.
  */
-static bignum *
-bignum_div_a1(const bignum *a, const bignum *b)
+static inline word
+bignum_div_preinv(word *r, word u1, word u0, word d, word v)
 {
-  assert(b->size == 1);
-
-  word digit = b->digit[0];
-  dword rem = 0;
-  bignum *r;
+  dword p;
+  word q1, q0, rem;
 
-  r = bignum_new();
-  bignum_resize(r, a->size);
+  p = (dword)v * u1 + ((dword)u1 << BIGNUM_SHIFT | u0);
+  q1 = (word)(p >> BIGNUM_SHIFT) + 1;
+  q0 = (word)p;
 
-  for (int i = a->size - 1; i >= 0; i--) {
-    rem = rem << BIGNUM_SHIFT | a->digit[i];
-    r->digit[i] = (word)(rem / digit);
-    rem = rem % digit;
+  rem = (word)((dword)u0 - (dword)q1 * d);
+  if (rem > q0) {
+    q1--;
+    rem = (word)(rem + d);
+  }
+  if (rem >= d) {
+    q1++;
+    rem = (word)(rem - d);
   }
 
-  return bignum_normalize(r);
+  *r = rem;
+  return q1;
 }
 
+/* Shorter operands divide directly; the inverse costs about one division. */
+#define BIGNUM_DIVREM_1_PREINV_THRESHOLD 4
+
 /*
- * Division based on Knuth's algorithm in TAOCP vol. 2 (3rd ed.), section 4.3.1, Algorithm D.
+ * q = a / d, where a has n digits. Return the remainder. q may be equal to a.
+ * d is normalized and a shifted with it on the fly, so that every digit costs
+ * a multiplication by the precomputed inverse instead of a division.
  */
-static bignum *
-bignum_div_a2(const bignum *a, const bignum *b)
+
+static word
+bignum_divrem_1(word *q, const word *a, int n, word d)
 {
-  bignum *u, *v, *res, *qv;
-  int n, m, d, neg;
-  dword q, r, uu, carry, borrow;
+  word v, rem;
+  int s;
 
-  assert(a->size >= b->size && b->size >= 2);
+  if (n < BIGNUM_DIVREM_1_PREINV_THRESHOLD) {
+    dword t = 0;
 
-  n = b->size;
-  m = a->size - b->size;
+    for (int i = n - 1; i >= 0; i--) {
+      t = t << BIGNUM_SHIFT | a[i];
+      q[i] = (word)(t / d);
+      t = t % d;
+    }
+    return (word)t;
+  }
 
-  u = bignum_new();
-  bignum_assign(u, a);
+  s = BIGNUM_SHIFT - bignum_bit_length(d);
+  d = (word)(d << s);
+  v = bignum_inverse_1(d);
 
-  v = bignum_new();
-  bignum_assign(v, b);
+  if (s == 0) {
+    rem = 0;
+    for (int i = n - 1; i >= 0; i--) {
+      q[i] = bignum_div_preinv(&rem, rem, a[i], d, v);
+    }
+    return rem;
+  }
 
-  qv = bignum_new();
-  bignum_assign(qv, v);
-  bignum_resize(qv, b->size + 1);
+  rem = (word)(a[n - 1] >> (BIGNUM_SHIFT - s));
+  for (int i = n - 1; i > 0; i--) {
+    word u0 = (word)(a[i] << s | a[i - 1] >> (BIGNUM_SHIFT - s));
+    q[i] = bignum_div_preinv(&rem, rem, u0, d, v);
+  }
+  q[0] = bignum_div_preinv(&rem, rem, (word)(a[0] << s), d, v);
 
-  res = bignum_new();
-  bignum_resize(res, m + 1);
+  return (word)(rem >> s);
+}
 
-  /* Normalization step. Make sure that the MSD of v >= BIGNUM_BASE/2. */
-  d = BIGNUM_SHIFT - bignum_bit_length(v->digit[v->size - 1]);
-  bignum_lshift(u, d);
-  bignum_lshift(v, d);
-  if (u->size < a->size + 1) {
-    bignum_resize(u, a->size + 1);
-  }
-  assert(v->size == b->size && v->digit[v->size - 1] >= BIGNUM_BASE / 2);
-
-  for (int j = m; j >= 0; j--) {
-    uu = ((dword)u->digit[j + n] << BIGNUM_SHIFT | (dword)u->digit[j + n - 1]);
-
-    q = uu / (dword)v->digit[n - 1];
-    r = uu % (dword)v->digit[n - 1];
-
-    while (q * (dword)v->digit[n - 2] > ((r << BIGNUM_SHIFT) | (dword)u->digit[j + n - 2]) ||
-        q == BIGNUM_BASE) {
-      q--;
-      r += v->digit[n - 1];
-      if (r >= BIGNUM_BASE) {
-        break;
-      }
-    }
-    assert(q < BIGNUM_BASE);
-
-  /* Check if a - b is negative. a is shifted by j. */
-#define IS_NEGATIVE(a, b, r) do {                                                          \
-    (r) = 0;                                                                               \
-    for (int i = n; i >= 0; i--) {                                                         \
-      if ((b)->digit[i] > (a)->digit[j + i]) {                                             \
-        (r) = 1; break;                                                                    \
-      }                                                                                    \
-      if ((b)->digit[i] < (a)->digit[j + i]) {                                             \
-        break;                                                                             \
-      }                                                                                    \
-    }                                                                                      \
-  } while (0)
-
-    /* Multiply v times q. */
-    carry = 0;
-    for (int i = 0; i < n; i++) {
-      carry += (dword)q * (dword)v->digit[i];
-      qv->digit[i] = carry & BIGNUM_MASK;
-      carry >>= BIGNUM_SHIFT;
-    }
-    qv->digit[n] = carry;
+/*
+ * q = a / 3, where a is known to be a multiple of 3. Multiplies by the inverse
+ * of 3 modulo BIGNUM_BASE instead of dividing. q may be equal to a.
+ */
+static void
+bignum_divexact_by3(word *q, const word *a, int n)
+{
+  const word third = (word)(BIGNUM_MASK / 3);
+  const word inv = (word)(2 * third + 1);
+  word borrow = 0, d;
+
+  for (int i = 0; i < n; i++) {
+    d = a[i] - borrow;
+    borrow = a[i] < borrow;
+    d = (word)(d * inv);
+    q[i] = d;
+    borrow += (d > third) + (d > 2 * third);
+  }
+  assert(borrow == 0);
+}
 
-    IS_NEGATIVE(u, qv, neg);
+/*
+ * Number-theoretic transform multiplication.
+ *
+ * The operands are cut into 27-bit pieces (independently of the digit size)
+ * and convolved modulo three NTT-friendly primes below 2^31. The coefficients
+ * of the convolution are below 2^25 * 2^54, less than the product of the
+ * primes (~2^87), so they are recovered exactly with the Chinese remainder
+ * theorem. Arithmetic modulo each prime is done in Montgomery form with
+ * R = 2^32.
+ */
 
-    /* This branch is taken with probability ~ 2/BIGNUM_BASE. */
-    if (neg) {
-      q--;
-      borrow = 0;
-      for (int i = 0; i < n; i++) {
-        borrow = BIGNUM_BASE + (dword)qv->digit[i] - (dword)v->digit[i] - borrow;
-        qv->digit[i] = borrow & BIGNUM_MASK;
-        borrow = borrow < BIGNUM_BASE;
-      }
-      qv->digit[n] -= borrow;
+#define BIGNUM_NTT_PIECE_BITS 27  /* Pieces stay below the smallest prime. */
+#define BIGNUM_NTT_PIECE_MASK ((1U << BIGNUM_NTT_PIECE_BITS) - 1)
+#define BIGNUM_NTT_LOG_MAX 25     /* Limited by the 2-adic order of the last prime. */
 
-      IS_NEGATIVE(u, qv, neg);
-      assert(neg == 0);
-    }
+/* Bit buffer holding a digit plus a partial piece. */
+#if BIGNUM_SHIFT == 64
+typedef dword bignum_ntt_bits;
+#else
+typedef uint64_t bignum_ntt_bits;
+#endif
 
-    borrow = 0;
-    for (int i = 0; i < n + 1; i++) {
-      borrow = BIGNUM_BASE + (dword)u->digit[j + i] - (dword)qv->digit[i] - borrow;
-      u->digit[j + i] = borrow & BIGNUM_MASK;
-      borrow = borrow < BIGNUM_BASE;
-    }
-    assert(borrow == 0);
+typedef struct bignum_ntt_prime {
+  uint32_t p;     /* p = c * 2^k + 1 */
+  uint32_t g;     /* Primitive root modulo p. */
+} bignum_ntt_prime;
 
-    res->digit[j] = q;
+static const bignum_ntt_prime bignum_ntt_primes[3] = {
+  { 2013265921U, 31 },  /* 15 * 2^27 + 1 */
+  { 469762049U, 3 },    /* 7 * 2^26 + 1 */
+  { 167772161U, 3 },    /* 5 * 2^25 + 1 */
+};
+
+static uint32_t
+bignum_ntt_pinv(uint32_t p)
+{
+  uint32_t inv = p;  /* Correct to 3 bits, each Newton step doubles it. */
+  for (int i = 0; i < 4; i++) {
+    inv *= 2 - p * inv;
+  }
+  return 0U - inv;
+}
 
-#undef IS_NEGATIVE
+static uint32_t
+bignum_ntt_pow(uint32_t x, uint64_t e, uint32_t p)
+{
+  uint64_t r = 1, b = x;
+  while (e > 0) {
+    if (e & 1) {
+      r = r * b % p;
+    }
+    b = b * b % p;
+    e >>= 1;
   }
+  return (uint32_t)r;
+}
 
-  bignum_free(u);
-  bignum_free(v);
-  bignum_free(qv);
+/*
+ * x mod p for x < 2p, without a data-dependent branch.
+ */
+static inline uint32_t
+bignum_ntt_reduce(uint32_t x, uint32_t p)
+{
+  return x - (p & (0U - (uint32_t)(x >= p)));
+}
 
-  return bignum_normalize(res);
+/*
+ * Montgomery reduction: t * 2^-32 mod p, t < p * 2^32.
+ */
+static inline uint32_t
+bignum_ntt_redc(uint64_t t, uint32_t p, uint32_t pinv)
+{
+  uint32_t m = (uint32_t)t * pinv;
+  uint32_t r = (uint32_t)((t + (uint64_t)m * p) >> 32);
+  return bignum_ntt_reduce(r, p);
 }
 
 /*
- * Convert the bignum object to the two's complement representation.
- * After that bignum->sign is treated as sign bit in the two's complement.
+ * Fill w[len..2*len) with the powers of a primitive 2*len-th root of unity
+ * (or its inverse) in Montgomery form, for every len = 1, 2, ..., n/2.
  */
 static void
-bignum_to_complement(bignum *a)
+bignum_ntt_roots(uint32_t *w, int n, uint32_t p, uint32_t g, int inverse)
 {
-  dword carry = 1;
+  uint32_t pinv = bignum_ntt_pinv(p);
 
-  /* Positive number already have a good two's complement representation. */
-  if (a->sign == BIGNUM_POSITIVE) {
-    a->sign = BIGNUM_POSITIVE_COMPLEMENT;
-    return;
-  }
+  for (int len = 1; len < n; len <<= 1) {
+    uint32_t root = bignum_ntt_pow(g, (p - 1) / (2 * (uint64_t)len), p);
 
-  a->sign = BIGNUM_NEGATIVE_COMPLEMENT;
+    if (inverse) {
+      root = bignum_ntt_pow(root, p - 2, p);
+    }
+    root = (uint32_t)(((uint64_t)root << 32) % p);
 
-  for (int i = 0; i < a->size; i++) {
-    carry += ~(a->digit[i]) & BIGNUM_MASK;
-    a->digit[i] = carry & BIGNUM_MASK;
-    carry >>= BIGNUM_SHIFT;
+    w[len] = (uint32_t)(((uint64_t)1 << 32) % p);
+    for (int j = 1; j < len; j++) {
+      w[len + j] = bignum_ntt_redc((uint64_t)w[len + j - 1] * root, p, pinv);
+    }
   }
-
-  a->sign = (a->sign + carry) & 1;
 }
 
 /*
- * Convert the two's complement representation to the correct bignum object.
+ * Butterflies lo..hi-1 of the layer with half-length len, numbered block by
+ * block: butterfly b pairs x[i + j] and x[i + j + len], i = b / len * 2 * len
+ * and j = b % len.
  */
 static void
-bignum_from_complement(bignum *a)
+bignum_ntt_layer(uint32_t *x, int len, int lo, int hi, const uint32_t *w, uint32_t p,
+                 uint32_t pinv, int inverse)
 {
-  dword borrow = 1;
-
-  /* Positive number already have a good bignum representation. */
-  if (a->sign == BIGNUM_POSITIVE_COMPLEMENT) {
-    a->sign = BIGNUM_POSITIVE;
-    return;
+  uint32_t *y = x + lo / len * 2 * len;
+  int j = lo % len;
+
+  while (lo < hi) {
+    int end = MIN(len, j + hi - lo);
+
+    lo += end - j;
+    if (!inverse) {
+      for (; j < end; j++) {
+        uint32_t u = y[j], v = y[j + len];
+        y[j] = bignum_ntt_reduce(u + v, p);
+        y[j + len] = bignum_ntt_redc((uint64_t)(u + p - v) * w[len + j], p, pinv);
+      }
+    } else {
+      for (; j < end; j++) {
+        uint32_t u = y[j];
+        uint32_t v = bignum_ntt_redc((uint64_t)y[j + len] * w[len + j], p, pinv);
+        y[j] = bignum_ntt_reduce(u + v, p);
+        y[j + len] = bignum_ntt_reduce(u + p - v, p);
+      }
+    }
+    y += 2 * len;
+    j = 0;
   }
+}
 
-  a->sign = BIGNUM_NEGATIVE;
+/* One layer of a transform split into chunks of butterflies. */
+typedef struct bignum_ntt_layer_job {
+  uint32_t *x;
+  const uint32_t *w;
+  int n, len, chunks, inverse;
+  uint32_t p, pinv;
+} bignum_ntt_layer_job;
 
-  for (int i = 0; i < a->size; i++) {
-    borrow = BIGNUM_BASE + (dword)a->digit[i] - borrow;
-    a->digit[i] = ~(borrow & BIGNUM_MASK);
-    borrow = borrow < BIGNUM_BASE;
-  }
+static void
+bignum_ntt_layer_task(void *arg, int i)
+{
+  bignum_ntt_layer_job *job = arg;
+  int half = job->n / 2;
 
-  assert(borrow == 0);  /* overflow. */
+  bignum_ntt_layer(job->x, job->len, (int)((long long)half * i / job->chunks),
+                   (int)((long long)half * (i + 1) / job->chunks), job->w, job->p, job->pinv,
+                   job->inverse);
 }
 
-void
-bignum_neg(bignum *a, bignum *b)
+static void
+bignum_ntt_run_layer(uint32_t *x, int n, int len, const uint32_t *w, uint32_t p,
+                     uint32_t pinv, int inverse, int chunks)
 {
-  assert(a != NULL && b != NULL);
+  bignum_ntt_layer_job job;
 
-  bignum_assign(b, a);
-  /* +1 to make sure that the final two's complement representation doesn't overflow. */
-  bignum_resize(b, a->size + 1);
-
-  bignum_to_complement(b);
-
-  b->sign = 1 - b->sign;
-  for (int i = 0; i < b->size; i++) {
-    b->digit[i] = ~b->digit[i];
+  if (chunks <= 1) {
+    bignum_ntt_layer(x, len, 0, n / 2, w, p, pinv, inverse);
+    return;
   }
 
-  bignum_from_complement(b);
-  bignum_normalize(b);
+  job.x = x;
+  job.w = w;
+  job.n = n;
+  job.len = len;
+  job.chunks = chunks;
+  job.inverse = inverse;
+  job.p = p;
+  job.pinv = pinv;
+  bignum_parallel_for(chunks, bignum_ntt_layer_task, &job);
 }
 
-void
-bignum_or(bignum *a, bignum *b, bignum *c)
+/*
+ * Forward transform, decimation in frequency. Natural order in, bit-reversed
+ * order out. Each layer is split into the given number of chunks.
+ */
+static void
+bignum_ntt_forward(uint32_t *x, int n, const uint32_t *w, uint32_t p, uint32_t pinv,
+                   int chunks)
 {
-  assert(a != NULL && b != NULL && c != NULL);
-
-  bignum *r = bignum_bitwise_op(a, b, '|');
-
-  bignum_assign(c, r);
-  bignum_free(r);
+  for (int len = n / 2; len >= 1; len >>= 1) {
+    bignum_ntt_run_layer(x, n, len, w, p, pinv, 0, chunks);
+  }
 }
 
-void
-bignum_xor(bignum *a, bignum *b, bignum *c)
+/*
+ * Inverse transform (without the 1/n scaling), decimation in time.
+ * Bit-reversed order in, natural order out.
+ */
+static void
+bignum_ntt_inverse(uint32_t *x, int n, const uint32_t *w, uint32_t p, uint32_t pinv,
+                   int chunks)
 {
-  assert(a != NULL && b != NULL && c != NULL);
-
-  bignum *r = bignum_bitwise_op(a, b, '^');
-
-  bignum_assign(c, r);
-  bignum_free(r);
+  for (int len = 1; len < n; len <<= 1) {
+    bignum_ntt_run_layer(x, n, len, w, p, pinv, 1, chunks);
+  }
 }
 
-void
-bignum_and(bignum *a, bignum *b, bignum *c)
+/*
+ * Cut a (na digits) into pieces of BIGNUM_NTT_PIECE_BITS bits, padded with
+ * zeros to n pieces.
+ */
+static void
+bignum_ntt_load(uint32_t *x, int n, const word *a, int na)
 {
-  assert(a != NULL && b != NULL && c != NULL);
-
-  bignum *r = bignum_bitwise_op(a, b, '&');
-
-  bignum_assign(c, r);
-  bignum_free(r);
+  bignum_ntt_bits buf = 0;
+  int bits = 0, i = 0;
+
+  for (int k = 0; k < na; k++) {
+    buf |= (bignum_ntt_bits)a[k] << bits;
+    bits += BIGNUM_SHIFT;
+    while (bits >= BIGNUM_NTT_PIECE_BITS) {
+      x[i++] = (uint32_t)buf & BIGNUM_NTT_PIECE_MASK;
+      buf >>= BIGNUM_NTT_PIECE_BITS;
+      bits -= BIGNUM_NTT_PIECE_BITS;
+    }
+  }
+  if (bits > 0) {
+    x[i++] = (uint32_t)buf;
+  }
+  memset(x + i, 0, sizeof(uint32_t) * (n - i));
 }
 
-/* Perform bitwise OR XOR AND. */
-static bignum *
-bignum_bitwise_op(bignum *a, bignum *b, char op)
+/*
+ * Cyclic convolution of a and b modulo the prime. The result replaces fa.
+ * fb is clobbered. fb == NULL means squaring. chunks is passed to the
+ * transforms.
+ */
+static void
+bignum_ntt_convolve(uint32_t *fa, uint32_t *fb, uint32_t *w, int n,
+                    const bignum_ntt_prime *prime, int chunks)
 {
-  bignum *r;
-  int size_a, size_b, i;
-  word pad;
+  uint32_t p = prime->p, pinv = bignum_ntt_pinv(p);
+  uint32_t scale;
 
-  size_a = a->size;
-  size_b = b->size;
+  bignum_ntt_roots(w, n, p, prime->g, 0);
+  bignum_ntt_forward(fa, n, w, p, pinv, chunks);
+  if (fb != NULL) {
+    bignum_ntt_forward(fb, n, w, p, pinv, chunks);
+  } else {
+    fb = fa;
+  }
 
-  if (size_a < size_b) {
-    { bignum *tmp = a; a = b; b = tmp; }
-    { int tmp = size_a; size_a = size_b; size_b = tmp; }
+  /* The pointwise products carry a 2^-32 factor. Fold it into the 1/n scale. */
+  scale = bignum_ntt_pow(n, p - 2, p);
+  scale = (uint32_t)(((uint64_t)scale << 32) % p);
+  scale = (uint32_t)(((uint64_t)scale << 32) % p);
+  for (int i = 0; i < n; i++) {
+    uint32_t t = bignum_ntt_redc((uint64_t)fa[i] * fb[i], p, pinv);
+    fa[i] = bignum_ntt_redc((uint64_t)t * scale, p, pinv);
   }
 
-  bignum_to_complement(a);
-  bignum_to_complement(b);
+  bignum_ntt_roots(w, n, p, prime->g, 1);
+  bignum_ntt_inverse(fa, n, w, p, pinv, chunks);
+}
 
-  if (b->sign == BIGNUM_POSITIVE_COMPLEMENT) {
-    pad = 0;
-  } else {
-    pad = BIGNUM_MASK;  /* 1111... */
-  }
+static int
+bignum_ntt_pieces(int na)
+{
+  return (int)(((long long)na * BIGNUM_SHIFT + BIGNUM_NTT_PIECE_BITS - 1) /
+               BIGNUM_NTT_PIECE_BITS);
+}
 
-  r = bignum_new();
+static int
+bignum_ntt_length(int na, int nb)
+{
+  long long pieces = (long long)bignum_ntt_pieces(na) + bignum_ntt_pieces(nb);
+  int log = 0;
 
-  switch (op) {
-    case '|':
-      r->sign = a->sign | b->sign;
-    break;
-    case '^':
-      r->sign = a->sign ^ b->sign;
-    break;
-    case '&':
-      r->sign = a->sign & b->sign;
-    break;
+  while (((long long)1 << log) < pieces) {
+    log++;
   }
+  return log;
+}
 
-  /* +1 if result is negative to make sure that the final two's complement
-     representation doesn't overflow. */
-  bignum_resize(r, size_a + r->sign);
+static int
+bignum_mul_ntt_fits(int na, int nb)
+{
+  return bignum_ntt_length(na, nb) <= BIGNUM_NTT_LOG_MAX;
+}
 
-  switch (op) {
-    case '|':
-      for (i = 0; i < size_b; i++) {
-        r->digit[i] = a->digit[i] | b->digit[i];
-      }
-      for (; i < size_a; i++) {
-        r->digit[i] = a->digit[i] | pad;
-      }
-    break;
-    case '^':
-      for (i = 0; i < size_b; i++) {
-        r->digit[i] = a->digit[i] ^ b->digit[i];
-      }
-      for (; i < size_a; i++) {
-        r->digit[i] = a->digit[i] ^ pad;
-      }
-    break;
-    case '&':
-      for (i = 0; i < size_b; i++) {
-        r->digit[i] = a->digit[i] & b->digit[i];
-      }
-      for (; i < size_a; i++) {
-        r->digit[i] = a->digit[i] & pad;
-      }
-    break;
-  }
+/* The convolutions modulo the three primes, run in parallel. */
+typedef struct bignum_ntt_job {
+  uint32_t *res[3];
+  const word *a, *b;
+  int na, nb, n, chunks;
+} bignum_ntt_job;
 
-  bignum_from_complement(a);
-  bignum_from_complement(b);
-  bignum_from_complement(r);
+static void
+bignum_ntt_task(void *arg, int t)
+{
+  bignum_ntt_job *job = arg;
+  int sqr = job->a == job->b && job->na == job->nb;
+  bignum_scratch_mark mark = bignum_scratch_save();
+  uint32_t *fb = NULL, *w;
+
+  w = bignum_scratch_alloc(sizeof(uint32_t) * (size_t)job->n);
+  bignum_ntt_load(job->res[t], job->n, job->a, job->na);
+  if (!sqr) {
+    fb = bignum_scratch_alloc(sizeof(uint32_t) * (size_t)job->n);
+    bignum_ntt_load(fb, job->n, job->b, job->nb);
+  }
+  bignum_ntt_convolve(job->res[t], fb, w, job->n, &bignum_ntt_primes[t], job->chunks);
 
-  return bignum_normalize(r);
+  bignum_scratch_restore(mark);
 }
 
-static int
-bignum_is_zero(const bignum *a)
+/*
+ * Run the three convolutions of job, in res[0..2]. From
+ * BIGNUM_MUL_PARALLEL_THRESHOLD digits the primes and the transform layers
+ * are spread over the thread pool.
+ */
+static void
+bignum_ntt_run(bignum_ntt_job *job)
 {
-  return a->size == 1 && a->digit[0] == 0;
+  job->chunks = 1;
+
+  if (MIN(job->na, job->nb) >= BIGNUM_MUL_PARALLEL_THRESHOLD && bignum_pool_size > 0) {
+    job->chunks = bignum_pool_size + 1;
+    bignum_parallel_for(3, bignum_ntt_task, job);
+  } else {
+    for (int t = 0; t < 3; t++) {
+      bignum_ntt_task(job, t);
+    }
+  }
 }
 
 /*
- * Shift digits s bits left. 0 <= s < BIGNUM_SHIFT.
+ * Garner's CRT of the n coefficients of res[0..2] and carry propagation into
+ * the nr digits of r. What is left above them goes to (hi, lo).
  */
 static void
-bignum_lshift(bignum *a, int s)
+bignum_ntt_carry(word *r, int nr, uint32_t *const *res, int n, uint64_t *hi_out,
+                 uint64_t *lo_out)
 {
-  assert(a != NULL);
-  assert(s < BIGNUM_SHIFT);
-
-  dword acc;
-  word carry = 0;
+  const bignum_ntt_prime *P = bignum_ntt_primes;
+  const uint32_t *r0 = res[0], *r1 = res[1], *r2 = res[2];
+  uint32_t inv01, inv012;
+  uint64_t p01, lo, hi;
+  bignum_ntt_bits out;
+  int bits, k;
+
+  inv01 = bignum_ntt_pow(P[0].p % P[1].p, P[1].p - 2, P[1].p);
+  p01 = (uint64_t)P[0].p * P[1].p;
+  inv012 = bignum_ntt_pow((uint32_t)(p01 % P[2].p), P[2].p - 2, P[2].p);
+
+  lo = hi = 0;
+  out = 0;
+  bits = 0;
+  k = 0;
+  for (int i = 0; k < nr; i++) {
+    if (i < n) {
+      uint64_t x01, t1, t2, mlo, mhi;
+
+      t1 = (uint64_t)(r1[i] + P[1].p - r0[i] % P[1].p) % P[1].p * inv01 % P[1].p;
+      x01 = r0[i] + P[0].p * t1;
+      t2 = (r2[i] + P[2].p - x01 % P[2].p) % P[2].p * inv012 % P[2].p;
+
+      /* (hi, lo) += x01 + p01 * t2 */
+      mlo = (p01 & 0xffffffffU) * t2;
+      mhi = (p01 >> 32) * t2 + (mlo >> 32);
+      mlo = (mlo & 0xffffffffU) | (mhi << 32);
+      mhi >>= 32;
+
+      lo += x01;
+      hi += lo < x01;
+      lo += mlo;
+      hi += (lo < mlo) + mhi;
+    }
 
-  bignum_resize(a, a->size + 1);
+    out |= (bignum_ntt_bits)(lo & BIGNUM_NTT_PIECE_MASK) << bits;
+    bits += BIGNUM_NTT_PIECE_BITS;
+    lo = (lo >> BIGNUM_NTT_PIECE_BITS) | (hi << (64 - BIGNUM_NTT_PIECE_BITS));
+    hi >>= BIGNUM_NTT_PIECE_BITS;
 
-  for (int i = 0; i < a->size; i++) {
-    acc = ((dword)a->digit[i] << s) | carry;
-    a->digit[i] = (word)(acc & BIGNUM_MASK);
-    carry = (word)(acc >> BIGNUM_SHIFT);
+    while (bits >= BIGNUM_SHIFT && k < nr) {
+      r[k++] = (word)(out & BIGNUM_MASK);
+      out >>= BIGNUM_SHIFT;
+      bits -= BIGNUM_SHIFT;
+    }
   }
 
-  assert(carry == 0);
-  bignum_normalize(a);
+  *hi_out = hi;
+  *lo_out = lo;
 }
 
+/*
+ * Multiply a (na digits) by b (nb digits) into r (na + nb digits) with the
+ * three-prime NTT. r must not overlap a or b.
+ */
 static void
-bignum_set_sign(bignum *a, int sign)
+bignum_mul_ntt(word *r, const word *a, int na, const word *b, int nb)
 {
-  a->sign = bignum_is_zero(a) == 1 ? BIGNUM_POSITIVE : sign;
+  int n = 1 << bignum_ntt_length(na, nb);
+  bignum_scratch_mark mark;
+  bignum_ntt_job job;
+  uint64_t lo, hi;
+
+  BIGNUM_STAT(mul_ntt, 1);
+
+  mark = bignum_scratch_save();
+  job.res[0] = bignum_scratch_alloc(sizeof(uint32_t) * 3 * (size_t)n);
+  job.res[1] = job.res[0] + n;
+  job.res[2] = job.res[1] + n;
+  job.a = a;
+  job.b = b;
+  job.na = na;
+  job.nb = nb;
+  job.n = n;
+  bignum_ntt_run(&job);
+
+  bignum_ntt_carry(r, na + nb, job.res, n, &hi, &lo);
+  assert(lo == 0 && hi == 0);
+
+  bignum_scratch_restore(mark);
 }
 
+/*
+ * Smallest m >= n for which products modulo BIGNUM_BASE^m - 1 are taken by
+ * bignum_mul_wrap with a cyclic NTT, whose length in pieces is a power of 2.
+ * Below the NTT range, or above the largest transform, n itself.
+ */
 static int
-bignum_bit_length(word x)
+bignum_mul_wrap_size(int n)
 {
-  int length = 0;
-  while (x > 0) {
-    length++;
-    x >>= 1;  /* Right shift with zero-extend. */
+  int log = 0;
+
+  if (n < BIGNUM_MUL_NTT_THRESHOLD) {
+    return n;
   }
-  return length;
+
+  while (((long long)BIGNUM_NTT_PIECE_BITS << log) < (long long)n * BIGNUM_SHIFT ||
+         ((long long)BIGNUM_NTT_PIECE_BITS << log) % BIGNUM_SHIFT != 0) {
+    log++;
+  }
+  if (log > BIGNUM_NTT_LOG_MAX) {
+    return n;
+  }
+  return (int)(((long long)BIGNUM_NTT_PIECE_BITS << log) / BIGNUM_SHIFT);
 }
 
-static bignum *
-bignum_normalize(bignum *a)
+/*
+ * r = a * b modulo BIGNUM_BASE^m - 1 (m digits), 1 <= na, nb <= m. The
+ * result is one of the two representations of 0 when the product is a
+ * multiple of BIGNUM_BASE^m - 1. For m from bignum_mul_wrap_size the product
+ * wraps around in a cyclic NTT of the length of m digits, half the length
+ * needed for the full product of two m-digit numbers. Otherwise the full
+ * product is folded. r must not overlap a or b.
+ */
+static void
+bignum_mul_wrap(word *r, const word *a, int na, const word *b, int nb, int m)
 {
-  while (a->size - 1 > 0 && a->digit[a->size - 1] == 0) {
-    a->size--;
+  bignum_scratch_mark mark;
+  word carry[128 / BIGNUM_SHIFT];
+  word cy;
+  int nc;
+
+  assert(na >= 1 && nb >= 1 && na <= m && nb <= m);
+
+  mark = bignum_scratch_save();
+
+  if (m >= BIGNUM_MUL_NTT_THRESHOLD && bignum_mul_wrap_size(m) == m) {
+    int n = (int)((long long)m * BIGNUM_SHIFT / BIGNUM_NTT_PIECE_BITS);
+    bignum_ntt_job job;
+    uint64_t lo, hi;
+
+    BIGNUM_STAT(mul_ntt, 1);
+
+    job.res[0] = bignum_scratch_alloc(sizeof(uint32_t) * 3 * (size_t)n);
+    job.res[1] = job.res[0] + n;
+    job.res[2] = job.res[1] + n;
+    job.a = a;
+    job.b = b;
+    job.na = na;
+    job.nb = nb;
+    job.n = n;
+    bignum_ntt_run(&job);
+
+    /* The m digits take exactly the n pieces. B^m = 1, so what is carried
+       out of them is added back at the bottom. */
+    bignum_ntt_carry(r, m, job.res, n, &hi, &lo);
+    for (nc = 0; lo != 0 || hi != 0; nc++) {
+      carry[nc] = (word)(lo & BIGNUM_MASK);
+#if BIGNUM_SHIFT == 64
+      lo = hi;
+      hi = 0;
+#else
+      lo = (lo >> BIGNUM_SHIFT) | (hi << (64 - BIGNUM_SHIFT));
+      hi >>= BIGNUM_SHIFT;
+#endif
+    }
+  } else {
+    word *t, *scratch = NULL;
+    int s = MIN(na, nb);
+
+    t = bignum_scratch_alloc(sizeof(word) * (na + nb));
+    if (bignum_mul_scratch_size(s) > 0) {
+      scratch = bignum_scratch_alloc(sizeof(word) * bignum_mul_scratch_size(s));
+    }
+    if (na >= nb) {
+      bignum_mul_digits(t, a, na, b, nb, scratch);
+    } else {
+      bignum_mul_digits(t, b, nb, a, na, scratch);
+    }
+
+    if (na + nb <= m) {
+      memcpy(r, t, sizeof(word) * (na + nb));
+      memset(r + na + nb, 0, sizeof(word) * (m - na - nb));
+    } else {
+      memcpy(r, t, sizeof(word) * m);
+      cy = bignum_add_digits(r, r, m, t + m, na + nb - m);
+      while (cy != 0) {
+        cy = bignum_add_1(r, r, m, 1);
+      }
+    }
+    nc = 0;
   }
-  return a;
-}
 
+  if (nc > 0) {
+    cy = bignum_add_digits(r, r, m, carry, nc);
+    while (cy != 0) {
+      cy = bignum_add_1(r, r, m, 1);
+    }
+  }
+
+  bignum_scratch_restore(mark);
+}
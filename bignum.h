@@ -5,11 +5,33 @@
 #ifndef _BIGNUM_H_INCLUDED_
 #define _BIGNUM_H_INCLUDED_
 
+#include <stddef.h>
 #include <stdint.h>
 
+/*
+ * Digit size in bits: 16, 32 or 64. The 64-bit configuration needs
+ * unsigned __int128 (GCC and Clang on 64-bit targets) for the double word.
+ */
+#ifndef BIGNUM_BITS_IN_DITGIT
 #define BIGNUM_BITS_IN_DITGIT 16
+#endif
+
+#if BIGNUM_BITS_IN_DITGIT == 64
+
+#ifndef __SIZEOF_INT128__
+#  error "BIGNUM_BITS_IN_DITGIT 64 requires unsigned __int128."
+#endif
+
+typedef uint64_t word;
+typedef int64_t sword;
+__extension__ typedef unsigned __int128 dword;
+__extension__ typedef __int128 sdword;
 
-#if BIGNUM_BITS_IN_DITGIT == 32
+#define BIGNUM_SHIFT 64
+#define BIGNUM_DECIMAL_DIGITS 19
+#define BIGNUM_DECIMAL_BASE 10000000000000000000ULL
+
+#elif BIGNUM_BITS_IN_DITGIT == 32
 
 typedef uint32_t word;
 typedef int32_t sword;
@@ -32,58 +54,386 @@ typedef int32_t sdword;
 #define BIGNUM_DECIMAL_BASE 10000
 
 #else
-#  error "BIGNUM_BITS_IN_DITGIT must be defined to 16 or 32."
+#  error "BIGNUM_BITS_IN_DITGIT must be defined to 16, 32 or 64."
 #endif
 
 #define BIGNUM_BASE ((dword)1 << BIGNUM_SHIFT)
 #define BIGNUM_MASK (BIGNUM_BASE - 1)
 
+/*
+ * Multiplication thresholds in digits of the shorter operand. Below
+ * BIGNUM_MUL_KARATSUBA_THRESHOLD the schoolbook method is used, below
+ * BIGNUM_MUL_TOOM3_THRESHOLD Karatsuba and Toom-Cook 3-way above it.
+ */
+#ifndef BIGNUM_MUL_KARATSUBA_THRESHOLD
+#  if BIGNUM_SHIFT == 64
+#    define BIGNUM_MUL_KARATSUBA_THRESHOLD 24
+#  else
+#    define BIGNUM_MUL_KARATSUBA_THRESHOLD 32
+#  endif
+#endif
+
+#ifndef BIGNUM_MUL_TOOM3_THRESHOLD
+#  if BIGNUM_SHIFT == 64
+#    define BIGNUM_MUL_TOOM3_THRESHOLD 96
+#  else
+#    define BIGNUM_MUL_TOOM3_THRESHOLD 128
+#  endif
+#endif
+
+/* Squaring switches from the schoolbook method to Karatsuba at this size. */
+#ifndef BIGNUM_SQR_KARATSUBA_THRESHOLD
+#  if BIGNUM_SHIFT == 64
+#    define BIGNUM_SQR_KARATSUBA_THRESHOLD 48
+#  else
+#    define BIGNUM_SQR_KARATSUBA_THRESHOLD 64
+#  endif
+#endif
+
+/*
+ * Above BIGNUM_MUL_NTT_THRESHOLD digits the product is computed with a
+ * three-prime number-theoretic transform, as long as it fits the largest
+ * supported transform length.
+ */
+#ifndef BIGNUM_MUL_NTT_THRESHOLD
+#  if BIGNUM_SHIFT == 64
+#    define BIGNUM_MUL_NTT_THRESHOLD 16384
+#  elif BIGNUM_SHIFT == 32
+#    define BIGNUM_MUL_NTT_THRESHOLD 8192
+#  else
+#    define BIGNUM_MUL_NTT_THRESHOLD 3072
+#  endif
+#endif
+
+/*
+ * Multiplications whose shorter operand has at least
+ * BIGNUM_MUL_PARALLEL_THRESHOLD digits split their Toom-3 point products and
+ * NTT transforms over the threads started by bignum_set_threads.
+ */
+#ifndef BIGNUM_MUL_PARALLEL_THRESHOLD
+#  if BIGNUM_SHIFT == 64
+#    define BIGNUM_MUL_PARALLEL_THRESHOLD 2048
+#  elif BIGNUM_SHIFT == 32
+#    define BIGNUM_MUL_PARALLEL_THRESHOLD 4096
+#  else
+#    define BIGNUM_MUL_PARALLEL_THRESHOLD 8192
+#  endif
+#endif
+
+/*
+ * Division switches from Algorithm D to Burnikel-Ziegler recursive division
+ * when both the divisor and the quotient have BIGNUM_DIV_BZ_THRESHOLD digits.
+ */
+#ifndef BIGNUM_DIV_BZ_THRESHOLD
+#  define BIGNUM_DIV_BZ_THRESHOLD 40
+#endif
+
+/*
+ * Above BIGNUM_DIV_NEWTON_THRESHOLD digits of the divisor and the quotient,
+ * the quotient is computed from a reciprocal found by Newton's iteration,
+ * with products taken modulo BIGNUM_BASE^m - 1 where the high digits are
+ * known. Reciprocals shorter than the threshold come from Burnikel-Ziegler.
+ */
+#ifndef BIGNUM_DIV_NEWTON_THRESHOLD
+#  if BIGNUM_SHIFT == 64
+#    define BIGNUM_DIV_NEWTON_THRESHOLD 65536
+#  elif BIGNUM_SHIFT == 32
+#    define BIGNUM_DIV_NEWTON_THRESHOLD 20480
+#  else
+#    define BIGNUM_DIV_NEWTON_THRESHOLD 6144
+#  endif
+#endif
+
+/*
+ * bignum_to_str converts numbers of at least BIGNUM_TO_STR_DC_THRESHOLD
+ * digits by dividing them by powers of 10.
+ */
+#ifndef BIGNUM_TO_STR_DC_THRESHOLD
+#  if BIGNUM_SHIFT == 64
+#    define BIGNUM_TO_STR_DC_THRESHOLD 20
+#  elif BIGNUM_SHIFT == 32
+#    define BIGNUM_TO_STR_DC_THRESHOLD 40
+#  else
+#    define BIGNUM_TO_STR_DC_THRESHOLD 60
+#  endif
+#endif
+
+/*
+ * bignum_assign_str converts strings of at least BIGNUM_FROM_STR_DC_THRESHOLD
+ * chunks of BIGNUM_DECIMAL_DIGITS characters (about one digit each) by
+ * combining halves with a multiplication by a power of 10.
+ */
+#ifndef BIGNUM_FROM_STR_DC_THRESHOLD
+#  define BIGNUM_FROM_STR_DC_THRESHOLD 40
+#endif
+
+#if BIGNUM_MUL_KARATSUBA_THRESHOLD < 2 || BIGNUM_MUL_TOOM3_THRESHOLD < 5 || \
+    BIGNUM_SQR_KARATSUBA_THRESHOLD < 2
+#  error "Multiplication thresholds are too small."
+#endif
+
+#if BIGNUM_DIV_BZ_THRESHOLD < 4
+#  error "BIGNUM_DIV_BZ_THRESHOLD is too small."
+#endif
+
+#if BIGNUM_DIV_NEWTON_THRESHOLD < 8
+#  error "BIGNUM_DIV_NEWTON_THRESHOLD is too small."
+#endif
+
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 #define BIGNUM_POSITIVE 10
 #define BIGNUM_NEGATIVE 11
 
-#define BIGNUM_POSITIVE_COMPLEMENT 0
-#define BIGNUM_NEGATIVE_COMPLEMENT 1
+/* Digits stored inside the object, enough for 128-bit values. */
+#define BIGNUM_INLINE_DIGITS (128 / BIGNUM_SHIFT)
 
+/*
+ * digit points either to inline_digit or to the heap, so an initialized
+ * object must not be copied by value; use bignum_assign.
+ */
 typedef struct bignum {
   int sign;
-  int size;
+  int size;   /* Digits in use. */
+  int alloc;  /* Digits allocated. */
   word *digit;
+  word inline_digit[BIGNUM_INLINE_DIGITS];
 } bignum;
 
+/*
+ * Memory functions with the signatures of malloc, realloc and free. NULL
+ * restores the standard library function.
+ */
+void bignum_set_allocator(void *(*alloc_func)(size_t),
+                          void *(*realloc_func)(void *, size_t),
+                          void (*free_func)(void *));
+
+/* Release the memory cached by the calling thread, e.g. before it exits. */
+void bignum_thread_cleanup(void);
+
+/*
+ * Per-thread counters, collected when the library is built with BIGNUM_STATS
+ * and left at zero otherwise. Work that a parallel multiplication or
+ * bignum_batch_run hands to the pool threads is counted for the calling
+ * thread. Algorithm counters count every call, the recursive ones included.
+ */
+#define BIGNUM_STATS_ADD 0
+#define BIGNUM_STATS_SUB 1
+#define BIGNUM_STATS_MUL 2
+#define BIGNUM_STATS_SQR 3
+#define BIGNUM_STATS_DIV 4       /* bignum_div and bignum_divmod. */
+#define BIGNUM_STATS_MOD 5
+#define BIGNUM_STATS_BITWISE 6
+#define BIGNUM_STATS_SHIFT 7
+#define BIGNUM_STATS_POWMOD 8
+#define BIGNUM_STATS_BARRETT 9
+#define BIGNUM_STATS_TO_STR 10
+#define BIGNUM_STATS_FROM_STR 11
+#define BIGNUM_STATS_NOPS 12
+
+typedef struct bignum_stats {
+  unsigned long long allocs;         /* Calls of the allocator, realloc included. */
+  unsigned long long alloc_bytes;
+  unsigned long long frees;
+  unsigned long long scratch_bytes;  /* Taken from the scratch arena. */
+  unsigned long long resizes;        /* bignum_resize calls... */
+  unsigned long long resize_copies;  /* ...that moved the digits to a larger block. */
+
+  unsigned long long calls[BIGNUM_STATS_NOPS];
+  unsigned long long digits[BIGNUM_STATS_NOPS];  /* Operand digits of those calls. */
+
+  unsigned long long mul_basecase;
+  unsigned long long mul_karatsuba;
+  unsigned long long mul_toom3;
+  unsigned long long mul_ntt;
+  unsigned long long sqr_basecase;
+  unsigned long long sqr_karatsuba;
+  unsigned long long sqr_toom3;
+  unsigned long long div_1;          /* Single-digit divisors. */
+  unsigned long long div_basecase;   /* Algorithm D. */
+  unsigned long long div_bz;
+  unsigned long long div_newton;
+  unsigned long long div_newton_adjust;  /* Newton: quotient block estimate moved by one. */
+  unsigned long long div_qhat_adjust;  /* Algorithm D: qhat lowered by the two-digit test. */
+  unsigned long long div_add_back;     /* Algorithm D: qhat still one too large. */
+} bignum_stats;
+
+void bignum_stats_get(bignum_stats *s);
+
+void bignum_stats_reset(void);
+
+/*
+ * Use n threads, the caller included, for multiplications above
+ * BIGNUM_MUL_PARALLEL_THRESHOLD; 1 (the default) stops the worker threads.
+ * The results do not depend on n. Must not be called while another thread
+ * is inside the library. Returns 0, or -1 when the threads could not all be
+ * started; none of the new ones are then left running, and the previous
+ * number of threads is used again, or 1 if even those cannot be restarted.
+ */
+int bignum_set_threads(int n);
+
+/*
+ * CPU features used by the x86-64 kernels, which are picked at run time.
+ * bignum_set_cpu_features restricts them to those in mask, e.g. 0 for the
+ * portable code only or -1 for all that the CPU has, and returns the ones in
+ * use. Must not be called while another thread is inside the library.
+ */
+#define BIGNUM_CPU_AVX2 1
+#define BIGNUM_CPU_AVX512 2
+#define BIGNUM_CPU_ADX 4     /* mulx/adcx/adox, with 64-bit digits. */
+
+int bignum_set_cpu_features(int mask);
+
 bignum *bignum_new(void);
 
 void bignum_free(bignum *a);
 
+/* For objects on the stack or embedded in other structures. */
+
+void bignum_init(bignum *a);
+
+void bignum_clear(bignum *a);
+
+int bignum_reserve(bignum *a, int n);
+
+void bignum_shrink_to_fit(bignum *a);
+
 void bignum_assign(bignum *a, const bignum *b);
 
 void bignum_assign_int(bignum *a, int b);
 
-void bignum_assign_str(bignum *a, char *b);
+void bignum_assign_str(bignum *a, const char *b);
+
+void bignum_assign_strn(bignum *a, const char *b, size_t n);
 
 int bignum_to_int(bignum *a);
 
 char *bignum_to_str(bignum *a);
 
+/* Arithmetic. c may be the same object as a or b, e.g. bignum_add(a, b, a). */
+
 void bignum_add(bignum *a, bignum *b, bignum *c);
 
 void bignum_sub(bignum *a, bignum *b, bignum *c);
 
 void bignum_mul(bignum *a, bignum *b, bignum *c);
 
+/* c = a * a. bignum_mul(a, a, c) takes the same squaring path. */
+void bignum_sqr(bignum *a, bignum *c);
+
 void bignum_div(bignum *a, bignum *b, bignum *c);
 
-/* Bitwise */
+/*
+ * q = a / b rounded toward zero, as bignum_div, and r = a - q * b, which has
+ * the sign of a (C's / and %). q and r must be different objects.
+ */
+void bignum_divmod(bignum *a, bignum *b, bignum *q, bignum *r);
+
+/* c = a mod b rounded toward negative infinity, so c has the sign of b. */
+void bignum_mod(bignum *a, bignum *b, bignum *c);
+
+/*
+ * Operations with a machine integer, in place when c (or q) is a, without
+ * temporary objects.
+ */
+
+void bignum_add_ui(bignum *a, uint64_t b, bignum *c);
+
+void bignum_add_si(bignum *a, int64_t b, bignum *c);
+
+void bignum_sub_ui(bignum *a, uint64_t b, bignum *c);
+
+void bignum_sub_si(bignum *a, int64_t b, bignum *c);
+
+void bignum_mul_ui(bignum *a, uint64_t b, bignum *c);
+
+void bignum_mul_si(bignum *a, int64_t b, bignum *c);
+
+/*
+ * q = a / b rounded toward zero, b != 0, as bignum_divmod. bignum_divmod_si
+ * returns the remainder, which has the sign of a; bignum_divmod_ui returns its
+ * absolute value.
+ */
+uint64_t bignum_divmod_ui(bignum *a, uint64_t b, bignum *q);
+
+int64_t bignum_divmod_si(bignum *a, int64_t b, bignum *q);
+
+/* c = a * 2^nbits, nbits >= 0. */
+void bignum_shl(const bignum *a, int nbits, bignum *c);
+
+/* c = a / 2^nbits rounded toward negative infinity, nbits >= 0 (Python's >>). */
+void bignum_shr(const bignum *a, int nbits, bignum *c);
+
+/*
+ * Modular exponentiation context for a fixed positive modulus, reusable for
+ * any number of bignum_powmod_mont calls. Odd moduli use Montgomery
+ * multiplication, even ones fall back to Barrett reduction.
+ */
+typedef struct bignum_mont bignum_mont;
+
+bignum_mont *bignum_mont_new(bignum *m);
+
+void bignum_mont_free(bignum_mont *ctx);
+
+/* c = a^e mod m, where e >= 0 and m > 0. The result is in [0, m). */
+void bignum_powmod(bignum *a, bignum *e, bignum *m, bignum *c);
+
+void bignum_powmod_mont(bignum_mont *ctx, bignum *a, bignum *e, bignum *c);
+
+/*
+ * Barrett reduction context for a fixed positive modulus m. bignum_mod_barrett
+ * computes c = x mod m in [0, m) with two multiplications when x has at most
+ * twice the digits of m, and divides otherwise.
+ */
+typedef struct bignum_barrett bignum_barrett;
+
+bignum_barrett *bignum_barrett_new(bignum *m);
+
+void bignum_barrett_free(bignum_barrett *ctx);
+
+void bignum_mod_barrett(bignum_barrett *ctx, bignum *x, bignum *c);
+
+/*
+ * Batches of independent operations c = a op b. The operands may be shared,
+ * but no result may be an operand or the result of another operation.
+ */
+#define BIGNUM_OP_ADD 0
+#define BIGNUM_OP_SUB 1
+#define BIGNUM_OP_MUL 2
+#define BIGNUM_OP_DIV 3
+#define BIGNUM_OP_MOD 4
+
+typedef struct bignum_op {
+  int op;  /* BIGNUM_OP_* */
+  bignum *a;
+  bignum *b;
+  bignum *c;
+} bignum_op;
+
+/*
+ * Run the n operations on nthreads threads, the caller included, taken from
+ * the pool of bignum_set_threads; nthreads <= 0 uses the whole pool. The
+ * most expensive operations are started first. progress, if not NULL, is
+ * called with the number of finished operations after each one, one call at
+ * a time.
+ */
+void bignum_batch_run(bignum_op *ops, int n, int nthreads,
+                      void (*progress)(void *arg, int done, int n), void *arg);
+
+/*
+ * Bitwise, on the infinite two's complement representation; bignum_neg is
+ * b = ~a. The operands are only read, so they may be shared between threads,
+ * and the result may be the same object as an operand.
+ */
 
-void bignum_neg(bignum *a, bignum *b);
+void bignum_neg(const bignum *a, bignum *b);
 
-void bignum_or(bignum *a, bignum *b, bignum *c);
+void bignum_or(const bignum *a, const bignum *b, bignum *c);
 
-void bignum_xor(bignum *a, bignum *b, bignum *c);
+void bignum_xor(const bignum *a, const bignum *b, bignum *c);
 
-void bignum_and(bignum *a, bignum *b, bignum *c);
+void bignum_and(const bignum *a, const bignum *b, bignum *c);
 
 #endif  // _BIGNUM_H_INCLUDED_
 
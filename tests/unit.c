@@ -2,9 +2,28 @@
 #include "unit.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <limits.h>
 
-#if BIGNUM_BITS_IN_DITGIT == 32
+#if BIGNUM_BITS_IN_DITGIT == 64
+
+#define BIGNUM_CMP_WITH_INT(a, b) do {                                                 \
+    int sign;                                                                          \
+    unsigned abs_b;                                                                    \
+    if ((b) >= 0) {                                                                    \
+      sign = BIGNUM_POSITIVE;                                                          \
+      abs_b = (unsigned)(b);                                                           \
+    } else {                                                                           \
+      sign = BIGNUM_NEGATIVE;                                                          \
+      abs_b = 0U - (unsigned)(b);                                                      \
+    }                                                                                  \
+    ASSERT_EQUAL_INT((a)->sign, sign);                                                 \
+    ASSERT_EQUAL_INT((a)->size, 1);                                                    \
+    ASSERT_EQUAL_UINT((unsigned)((a)->digit[0] >> 32), 0U);                            \
+    ASSERT_EQUAL_UINT((unsigned)(a)->digit[0], abs_b);                                 \
+  } while (0)
+
+#elif BIGNUM_BITS_IN_DITGIT == 32
 
 #define BIGNUM_CMP_WITH_INT(a, b) do {                                                 \
     int sign;                                                                          \
@@ -33,7 +52,7 @@
       sign = BIGNUM_NEGATIVE;                                                          \
       abs_b = 0U - (unsigned)(b);                                                      \
     }                                                                                  \
-    ASSERT_EQUAL_INT(a->sign, sign);                                                   \
+    ASSERT_EQUAL_INT((a)->sign, sign);                                                 \
     if (abs_b >= 1U << 16) {                                                           \
       ASSERT_EQUAL_INT((a)->size, 2);                                                  \
       ASSERT_EQUAL_UINT((a)->digit[0], (abs_b & 0xffff));                              \
@@ -112,6 +131,684 @@ bignum_assign_str_tests()
   bignum_assign_str(a, "-2147483648"); /* INT_MIN: -2^31 */
   BIGNUM_CMP_WITH_INT(a, -2147483648);
 
+  bignum_assign_str(a, "-0000000000000000000000000000000000000000000012345");
+  BIGNUM_CMP_WITH_INT(a, -12345);
+
+  bignum_assign_str(a, "-");
+  BIGNUM_CMP_WITH_INT(a, 0);
+
+  /* Only the first n characters are read. */
+  bignum_assign_strn(a, "-65536999", 6);
+  BIGNUM_CMP_WITH_INT(a, -65536);
+
+  bignum_free(a);
+}
+
+void
+bignum_to_str_tests()
+{
+  bignum *a = bignum_new();
+  static char buf[3002];
+  char *s;
+
+  bignum_assign_int(a, 0);
+  s = bignum_to_str(a);
+  ASSERT_EQUAL_INT(strcmp(s, "0"), 0);
+  free(s);
+
+  bignum_assign_int(a, INT_MIN);
+  s = bignum_to_str(a);
+  ASSERT_EQUAL_INT(strcmp(s, "-2147483648"), 0);
+  free(s);
+
+  /* Long enough for the divide and conquer conversion. */
+  memset(buf, '0', sizeof(buf) - 1);
+  buf[0] = '1';
+  buf[1500] = '7';
+  buf[sizeof(buf) - 2] = '1';
+  bignum_assign_str(a, buf);
+  s = bignum_to_str(a);
+  ASSERT_EQUAL_INT(strcmp(s, buf), 0);
+  free(s);
+
+  memset(buf, '9', sizeof(buf) - 1);
+  buf[0] = '-';
+  bignum_assign_str(a, buf);
+  s = bignum_to_str(a);
+  ASSERT_EQUAL_INT(strcmp(s, buf), 0);
+  free(s);
+
+  bignum_free(a);
+}
+
+void
+bignum_div_tests()
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+  bignum *c = bignum_new();
+  static char x[2001], y[1001];
+  char *s;
+
+  /* Large enough for the recursive division. */
+  for (int i = 0; i < 2000; i++) {
+    x[i] = '1' + i % 9;
+  }
+  memset(y, '9', 1000);
+
+  bignum_assign_str(a, x);
+  bignum_assign_str(b, y);
+  bignum_mul(a, b, c);
+  bignum_sub(c, b, c);
+  bignum_assign_int(a, 1);
+  bignum_add(c, a, c);  /* x*y - y + 1 */
+
+  bignum_div(c, b, c);
+  bignum_sub(c, a, a);  /* x - 1 - 1 */
+  s = bignum_to_str(a);
+  x[1999] -= 2;
+  ASSERT_EQUAL_INT(strcmp(s, x), 0);
+  free(s);
+
+  bignum_free(a);
+  bignum_free(b);
+  bignum_free(c);
+}
+
+void
+bignum_sqr_tests()
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+  bignum *c = bignum_new();
+  static char x[3001];
+  char *s, *t;
+
+  /* (-(2^100 + 1))^2 = 2^200 + 2^101 + 1 */
+  bignum_assign_str(a, "-1267650600228229401496703205377");
+  bignum_sqr(a, a);
+  s = bignum_to_str(a);
+  ASSERT_EQUAL_INT(strcmp(s, "1606938044258990275541962092343697903722659452585786241712129"), 0);
+  free(s);
+
+  /* Large enough for the Karatsuba and Toom-3 squaring. */
+  for (int i = 0; i < 3000; i++) {
+    x[i] = '1' + (i * 7) % 9;
+  }
+  bignum_assign_str(a, x);
+  bignum_assign_str(b, x);
+  bignum_mul(a, b, c);
+  s = bignum_to_str(c);
+  bignum_mul(a, a, c);
+  t = bignum_to_str(c);
+  ASSERT_EQUAL_INT(strcmp(s, t), 0);
+  free(s);
+  free(t);
+
+  bignum_free(a);
+  bignum_free(b);
+  bignum_free(c);
+}
+
+/* n digits, all ones or pseudo-random from seed, with a nonzero top digit. */
+static void
+fill_digits(bignum *a, int n, uint64_t seed, int ones)
+{
+  uint64_t x = seed;
+
+  bignum_reserve(a, n);
+  a->sign = BIGNUM_POSITIVE;
+  a->size = n;
+  for (int i = 0; i < n; i++) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    a->digit[i] = ones ? (word)BIGNUM_MASK : (word)((x ^ x >> 29) >> (64 - BIGNUM_SHIFT));
+  }
+  a->digit[n - 1] |= 1;
+}
+
+/* Schoolbook reference product of the absolute values. */
+static void
+ref_mul(const bignum *a, const bignum *b, bignum *c)
+{
+  int n = a->size + b->size;
+
+  bignum_reserve(c, n);
+  memset(c->digit, 0, sizeof(word) * n);
+  for (int i = 0; i < a->size; i++) {
+    dword carry = 0;
+    for (int j = 0; j < b->size; j++) {
+      carry += (dword)a->digit[i] * b->digit[j] + c->digit[i + j];
+      c->digit[i + j] = (word)carry;
+      carry >>= BIGNUM_SHIFT;
+    }
+    c->digit[i + b->size] = (word)carry;
+  }
+  c->sign = BIGNUM_POSITIVE;
+  c->size = n;
+  while (c->size > 1 && c->digit[c->size - 1] == 0) {
+    c->size--;
+  }
+}
+
+/* Check a * b and, when b is NULL, bignum_sqr(a) against ref_mul. */
+static void
+check_mul(bignum *a, bignum *b)
+{
+  bignum *c = bignum_new();
+  bignum *d = bignum_new();
+
+  if (b != NULL) {
+    bignum_mul(a, b, c);
+    ref_mul(a, b, d);
+  } else {
+    bignum_sqr(a, c);
+    ref_mul(a, a, d);
+  }
+  bignum_sub(c, d, d);
+  BIGNUM_CMP_WITH_INT(d, 0);
+
+  bignum_free(c);
+  bignum_free(d);
+}
+
+static void
+check_mul_sizes(int na, int nb, unsigned seed)
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+
+  for (int ones = 0; ones < 2; ones++) {
+    fill_digits(a, na, seed, ones);
+    fill_digits(b, nb, seed + 1, ones);
+    check_mul(a, b);
+    check_mul(b, a);
+  }
+
+  bignum_free(a);
+  bignum_free(b);
+}
+
+void
+bignum_karatsuba_tests()
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+  bignum *c = bignum_new();
+  const int k = BIGNUM_MUL_KARATSUBA_THRESHOLD;
+  const int sk = BIGNUM_SQR_KARATSUBA_THRESHOLD;
+  static const int dn[] = { -1, 0, 1 };
+
+  for (int i = 0; i < 3; i++) {
+    check_mul_sizes(k + dn[i], k + dn[i], i);
+    check_mul_sizes(2 * k + dn[i], 2 * k + dn[i], i);
+    check_mul_sizes(k + dn[i], 3 * (k + dn[i]), i);  /* N x 3N */
+    check_mul_sizes(k + dn[i], 3 * k + 2, i);        /* Last slice shorter. */
+    check_mul_sizes(1, 5 * k + dn[i], i);            /* 1 x N */
+
+    fill_digits(a, sk + dn[i], i, 0);
+    check_mul(a, NULL);
+    fill_digits(a, sk + dn[i], i, 1);
+    check_mul(a, NULL);
+  }
+
+  /* (B^n - 1)^2 = B^2n - 2 B^n + 1, through the product of two objects. */
+  for (int n = k - 1; n <= 2 * k + 1; n += k / 2 + 1) {
+    fill_digits(a, n, 0, 1);
+    bignum_assign(b, a);
+    bignum_mul(a, b, c);
+    bignum_assign_int(b, 1);
+    bignum_shl(b, n * BIGNUM_SHIFT, b);
+    bignum_add(c, b, c);
+    bignum_add(c, b, c);
+    bignum_shl(b, n * BIGNUM_SHIFT, b);
+    bignum_sub(c, b, c);
+    BIGNUM_CMP_WITH_INT(c, 1);
+  }
+
+  bignum_free(a);
+  bignum_free(b);
+  bignum_free(c);
+}
+
+void
+bignum_toom3_tests()
+{
+  bignum *a = bignum_new();
+  const int k = BIGNUM_MUL_TOOM3_THRESHOLD;
+  static const int dn[] = { -1, 0, 1 };
+
+  for (int i = 0; i < 3; i++) {
+    check_mul_sizes(k + dn[i], k + dn[i], i);
+    check_mul_sizes(3 * k + 2 * dn[i], 3 * k + 2 * dn[i], i);  /* Odd and even lengths. */
+    check_mul_sizes(k + dn[i], 4 * k + 1, i);
+
+    for (int ones = 0; ones < 2; ones++) {
+      fill_digits(a, k + dn[i], i, ones);
+      check_mul(a, NULL);
+      fill_digits(a, 2 * k + 1 + dn[i], i, ones);
+      check_mul(a, NULL);
+    }
+  }
+
+  bignum_free(a);
+}
+
+void
+bignum_ntt_tests()
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+  const int k = BIGNUM_MUL_NTT_THRESHOLD;
+
+  /* The reference products are quadratic, so each size is checked once. */
+  fill_digits(a, k - 1, 1, 0);
+  fill_digits(b, k - 1, 2, 1);
+  check_mul(a, b);
+  fill_digits(a, k, 3, 0);
+  fill_digits(b, k, 4, 0);
+  check_mul(a, b);
+  fill_digits(a, k + 1, 5, 1);
+  fill_digits(b, k + 3, 6, 1);
+  check_mul(a, b);
+  fill_digits(b, 2 * k + 1, 7, 0);
+  check_mul(b, a);
+
+  fill_digits(a, k + 1, 8, 1);
+  check_mul(a, NULL);
+  fill_digits(a, k, 9, 0);
+  check_mul(a, NULL);
+
+  bignum_free(a);
+  bignum_free(b);
+}
+
+/* q * b + r == a and 0 <= r < b for positive a and b. */
+static void
+check_divmod(bignum *a, bignum *b)
+{
+  bignum *q = bignum_new();
+  bignum *r = bignum_new();
+  bignum *t = bignum_new();
+
+  bignum_divmod(a, b, q, r);
+  ASSERT_EQUAL_INT(r->sign, BIGNUM_POSITIVE);
+  bignum_sub(r, b, t);
+  ASSERT_EQUAL_INT(t->sign, BIGNUM_NEGATIVE);
+  bignum_mul(q, b, t);
+  bignum_add(t, r, t);
+  bignum_sub(t, a, t);
+  BIGNUM_CMP_WITH_INT(t, 0);
+
+  bignum_free(q);
+  bignum_free(r);
+  bignum_free(t);
+}
+
+void
+bignum_bz_tests()
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+  bignum *c = bignum_new();
+  const int k = BIGNUM_DIV_BZ_THRESHOLD;
+  const int nv[] = { k - 1, k, k + 1, 2 * k + 3, 5 * k };
+
+  for (int i = 0; i < 5; i++) {
+    int n = nv[i];
+    const int nq[] = { k - 1, k, n, 3 * n + 1 };
+
+    for (int j = 0; j < 4; j++) {
+      for (int kind = 0; kind < 4; kind++) {
+        if (kind < 2) {
+          fill_digits(b, n, i, kind);
+        } else {
+          /* Just above B^(n-1): the divisor is shifted by almost a digit. */
+          bignum_assign_int(b, 1);
+          bignum_shl(b, (n - 1) * BIGNUM_SHIFT, b);
+          bignum_assign_int(c, kind == 2 ? 1 : 12345);
+          bignum_add(b, c, b);
+        }
+
+        fill_digits(a, n + nq[j], j, kind == 1);
+        check_divmod(a, b);
+
+        /* The largest remainder: a = c * b + b - 1. */
+        fill_digits(c, nq[j], j + 7, kind == 3);
+        bignum_mul(c, b, a);
+        bignum_add(a, b, a);
+        bignum_assign_int(c, 1);
+        bignum_sub(a, c, a);
+        check_divmod(a, b);
+
+        /* a = b * B^qn - 1, an all-ones quotient that takes the corrections. */
+        bignum_shl(b, nq[j] * BIGNUM_SHIFT, a);
+        bignum_sub(a, c, a);
+        check_divmod(a, b);
+      }
+    }
+  }
+
+  bignum_free(a);
+  bignum_free(b);
+  bignum_free(c);
+}
+
+void
+bignum_newton_tests()
+{
+#if BIGNUM_DIV_NEWTON_THRESHOLD <= 512
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+  bignum *c = bignum_new();
+  const int k = BIGNUM_DIV_NEWTON_THRESHOLD;
+  const int nv[] = { k - 1, k, k + 1, 2 * k + 3 };
+  bignum_stats s;
+
+  bignum_stats_reset();
+
+  for (int i = 0; i < 4; i++) {
+    int n = nv[i];
+    const int nq[] = { k - 1, k, n, 3 * n + 1 };
+
+    for (int j = 0; j < 4; j++) {
+      for (int kind = 0; kind < 3; kind++) {
+        if (kind < 2) {
+          fill_digits(b, n, i + 20, kind);
+        } else {
+          bignum_assign_int(b, 1);
+          bignum_shl(b, (n - 1) * BIGNUM_SHIFT, b);
+          bignum_add(b, b, b);
+          bignum_assign_int(c, 3);
+          bignum_add(b, c, b);
+        }
+
+        fill_digits(a, n + nq[j], j + 20, kind == 1);
+        check_divmod(a, b);
+
+        /* The largest remainder, where the estimates tend to be low. */
+        fill_digits(c, nq[j], j + 27, 0);
+        bignum_mul(c, b, a);
+        bignum_add(a, b, a);
+        bignum_assign_int(c, 1);
+        bignum_sub(a, c, a);
+        check_divmod(a, b);
+
+        /* A multiple of b, where they tend to be high. */
+        fill_digits(c, nq[j], j + 31, kind == 1);
+        bignum_mul(c, b, a);
+        check_divmod(a, b);
+      }
+    }
+  }
+
+  bignum_stats_get(&s);
+#ifdef BIGNUM_STATS
+  ASSERT_EQUAL_INT(s.div_newton > 0, 1);
+  ASSERT_EQUAL_INT(s.div_newton_adjust > 0, 1);
+#endif
+
+  bignum_free(a);
+  bignum_free(b);
+  bignum_free(c);
+#endif
+}
+
+void
+bignum_shift_tests()
+{
+  bignum *a = bignum_new();
+  bignum *c = bignum_new();
+  char *s;
+
+  bignum_assign_int(a, -5);
+  bignum_shr(a, 1, c);
+  BIGNUM_CMP_WITH_INT(c, -3);
+  bignum_assign_int(a, -4);
+  bignum_shr(a, 1, c);
+  BIGNUM_CMP_WITH_INT(c, -2);
+  bignum_shr(a, 200, c);
+  BIGNUM_CMP_WITH_INT(c, -1);
+  bignum_assign_int(a, 5);
+  bignum_shr(a, 200, c);
+  BIGNUM_CMP_WITH_INT(c, 0);
+
+  /* In place across digit boundaries. */
+  bignum_assign_int(a, -3);
+  bignum_shl(a, 100, a);
+  s = bignum_to_str(a);
+  ASSERT_EQUAL_INT(strcmp(s, "-3802951800684688204490109616128"), 0);
+  free(s);
+  bignum_shr(a, 99, a);
+  BIGNUM_CMP_WITH_INT(a, -6);
+  bignum_shr(a, 2, a);
+  BIGNUM_CMP_WITH_INT(a, -2);
+
+  bignum_free(a);
+  bignum_free(c);
+}
+
+void
+bignum_divmod_tests()
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+  bignum *q = bignum_new();
+  bignum *r = bignum_new();
+  static const int cases[][2] = { { 7, 2 }, { -7, 2 }, { 7, -2 }, { -7, -2 }, { 6, -3 }, { 1, 5 } };
+  int i;
+
+  for (i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++) {
+    bignum_assign_int(a, cases[i][0]);
+    bignum_assign_int(b, cases[i][1]);
+
+    bignum_divmod(a, b, q, r);
+    BIGNUM_CMP_WITH_INT(q, cases[i][0] / cases[i][1]);
+    BIGNUM_CMP_WITH_INT(r, cases[i][0] % cases[i][1]);
+
+    /* Floor remainder, with the sign of b. */
+    bignum_mod(a, b, b);
+    BIGNUM_CMP_WITH_INT(b, (cases[i][0] % cases[i][1] + cases[i][1]) % cases[i][1]);
+  }
+
+  /* -(2^200 + 5) divided by 2^100 in place. */
+  bignum_assign_str(a, "-1606938044258990275541962092341162602522202993782792835301381");
+  bignum_assign_str(b, "1267650600228229401496703205376");
+  bignum_divmod(a, b, a, r);
+  BIGNUM_CMP_WITH_INT(r, -5);
+  bignum_mod(r, b, r);
+  bignum_sub(b, r, b);
+  BIGNUM_CMP_WITH_INT(b, 5);
+
+  bignum_free(a);
+  bignum_free(b);
+  bignum_free(q);
+  bignum_free(r);
+}
+
+void
+bignum_scalar_tests()
+{
+  bignum *a = bignum_new();
+  bignum *c = bignum_new();
+  const char *x = "-123456789012345678901234567890";
+  char *s;
+
+  bignum_assign_str(a, x);
+  bignum_add_ui(a, 18446744073709551615ULL, c);
+  s = bignum_to_str(c);
+  ASSERT_EQUAL_INT(strcmp(s, "-123456788993898934827525016275"), 0);
+  free(s);
+
+  bignum_sub_si(a, INT64_MIN, c);
+  s = bignum_to_str(c);
+  ASSERT_EQUAL_INT(strcmp(s, "-123456789003122306864379792082"), 0);
+  free(s);
+
+  bignum_add_si(c, INT64_MIN, c);
+  bignum_sub(c, a, c);
+  BIGNUM_CMP_WITH_INT(c, 0);
+
+  bignum_assign(c, a);
+  bignum_mul_ui(c, 18446744073709551615ULL, c);
+  s = bignum_to_str(c);
+  ASSERT_EQUAL_INT(strcmp(s, "-2277375791072698140124934049010216029110176642350"), 0);
+  free(s);
+
+  bignum_mul_si(a, -3, c);
+  s = bignum_to_str(c);
+  ASSERT_EQUAL_INT(strcmp(s, "370370367037037036703703703670"), 0);
+  free(s);
+
+  bignum_mul_si(a, 0, c);
+  BIGNUM_CMP_WITH_INT(c, 0);
+
+  bignum_assign(c, a);
+  ASSERT_EQUAL_INT(bignum_divmod_ui(c, 18446744073709551557ULL, c) == 14083848168701016196ULL, 1);
+  s = bignum_to_str(c);
+  ASSERT_EQUAL_INT(strcmp(s, "-6692605942"), 0);  /* Truncated toward zero. */
+  free(s);
+  ASSERT_EQUAL_INT(bignum_divmod_si(a, -1000003, c) == -671935, 1);
+  s = bignum_to_str(c);
+  ASSERT_EQUAL_INT(strcmp(s, "123456418643089749631985"), 0);
+  free(s);
+
+  /* Long dividends, with divisors whose top bit is set and is not set. */
+  bignum_assign_str(a, "9876543210987654321098765432109876543210987654321098765432109876543210");
+  for (int i = 0; i < 4; i++) {
+    static const uint64_t d[] = { 0xffff, 0x8001, 7, 10000 };
+    uint64_t r = bignum_divmod_ui(a, d[i], c);
+
+    bignum_mul_ui(c, d[i], c);
+    bignum_add_ui(c, r, c);
+    bignum_sub(c, a, c);
+    BIGNUM_CMP_WITH_INT(c, 0);
+    ASSERT_EQUAL_INT(r < d[i], 1);
+  }
+
+  bignum_assign_int(a, -5);
+  ASSERT_EQUAL_INT(bignum_divmod_si(a, INT64_MIN, c) == -5, 1);
+  BIGNUM_CMP_WITH_INT(c, 0);
+  ASSERT_EQUAL_INT(bignum_divmod_ui(a, 1ULL << 40, c) == 5, 1);
+  BIGNUM_CMP_WITH_INT(c, 0);
+
+  bignum_free(a);
+  bignum_free(c);
+}
+
+void
+bignum_powmod_tests()
+{
+  bignum *a = bignum_new();
+  bignum *e = bignum_new();
+  bignum *m = bignum_new();
+  bignum *c = bignum_new();
+  bignum_mont *ctx;
+
+  bignum_assign_int(a, 4);
+  bignum_assign_int(e, 13);
+  bignum_assign_int(m, 497);
+  bignum_powmod(a, e, m, c);
+  BIGNUM_CMP_WITH_INT(c, 445);
+
+  /* Even modulus. */
+  bignum_assign_int(a, 3);
+  bignum_assign_int(e, 201);
+  bignum_assign_int(m, 1000);
+  bignum_powmod(a, e, m, a);
+  BIGNUM_CMP_WITH_INT(a, 3);
+
+  bignum_assign_int(a, -2);
+  bignum_assign_int(e, 3);
+  bignum_assign_int(m, 5);
+  bignum_powmod(a, e, m, c);
+  BIGNUM_CMP_WITH_INT(c, 2);
+
+  bignum_assign_int(e, 0);
+  bignum_powmod(a, e, m, c);
+  BIGNUM_CMP_WITH_INT(c, 1);
+
+  /* Fermat's little theorem for the prime 2^127 - 1, with a reused context. */
+  bignum_assign_str(m, "170141183460469231731687303715884105727");
+  bignum_assign_str(e, "170141183460469231731687303715884105726");
+  ctx = bignum_mont_new(m);
+  for (int i = 2; i < 6; i++) {
+    bignum_assign_int(a, -i);
+    bignum_powmod_mont(ctx, a, e, c);
+    BIGNUM_CMP_WITH_INT(c, 1);
+  }
+  bignum_mont_free(ctx);
+
+  bignum_free(a);
+  bignum_free(e);
+  bignum_free(m);
+  bignum_free(c);
+}
+
+void
+bignum_barrett_tests()
+{
+  bignum *m = bignum_new();
+  bignum *x = bignum_new();
+  bignum *c = bignum_new();
+  bignum_barrett *ctx;
+
+  bignum_assign_str(m, "1000000000000000000000000000000");
+  ctx = bignum_barrett_new(m);
+
+  /* (m - 1)^2 = 1 (mod m). */
+  bignum_assign_str(x, "999999999999999999999999999999");
+  bignum_mul(x, x, x);
+  bignum_mod_barrett(ctx, x, c);
+  BIGNUM_CMP_WITH_INT(c, 1);
+
+  bignum_assign_int(x, -7);
+  bignum_mod_barrett(ctx, x, x);
+  bignum_sub(m, x, x);
+  BIGNUM_CMP_WITH_INT(x, 7);
+
+  /* Longer than twice the modulus. */
+  bignum_mul(m, m, x);
+  bignum_mul(x, m, x);
+  bignum_assign_int(c, 5);
+  bignum_add(x, c, x);
+  bignum_mod_barrett(ctx, x, c);
+  BIGNUM_CMP_WITH_INT(c, 5);
+
+  bignum_barrett_free(ctx);
+  bignum_free(m);
+  bignum_free(x);
+  bignum_free(c);
+}
+
+void
+bignum_reserve_tests()
+{
+  bignum *a = bignum_new();
+  word *digit;
+
+  bignum_assign_int(a, -12345);
+  ASSERT_EQUAL_INT(bignum_reserve(a, 100), 0);
+  ASSERT_EQUAL_INT(a->alloc >= 100, 1);
+  BIGNUM_CMP_WITH_INT(a, -12345);
+
+  /* Assigning smaller values reuses the buffer. */
+  digit = a->digit;
+  bignum_assign_int(a, INT_MAX);
+  bignum_assign_str(a, "123456789012345678901234567890");
+  bignum_assign_int(a, 7);
+  ASSERT_EQUAL_INT(a->digit == digit, 1);
+  BIGNUM_CMP_WITH_INT(a, 7);
+
+  bignum_shrink_to_fit(a);
+  ASSERT_EQUAL_INT(a->digit == a->inline_digit, 1);
+  ASSERT_EQUAL_INT(a->alloc, BIGNUM_INLINE_DIGITS);
+  BIGNUM_CMP_WITH_INT(a, 7);
+
+  bignum_assign_str(a, "123456789012345678901234567890123456789012345");
+  ASSERT_EQUAL_INT(bignum_reserve(a, 100), 0);
+  bignum_shrink_to_fit(a);
+  ASSERT_EQUAL_INT(a->alloc, a->size);
+
   bignum_free(a);
 }
 
@@ -155,13 +852,561 @@ bignum_neg_tests()
   bignum_free(b);
 }
 
+void
+bignum_bitwise_tests()
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+  bignum *c = bignum_new();
+
+  /* Negative operands are left unchanged. */
+  bignum_assign_int(a, -12345);
+  bignum_assign_int(b, 255);
+  bignum_and(a, b, c);
+  BIGNUM_CMP_WITH_INT(c, 199);
+  bignum_or(a, b, c);
+  BIGNUM_CMP_WITH_INT(c, -12289);
+  BIGNUM_CMP_WITH_INT(a, -12345);
+
+  bignum_assign_int(b, -256);
+  bignum_xor(a, b, b);
+  BIGNUM_CMP_WITH_INT(b, 12487);
+  BIGNUM_CMP_WITH_INT(a, -12345);
+
+  /* The magnitude 2^31 needs the extra digit. */
+  bignum_assign_int(a, INT_MIN + 1);
+  bignum_assign_int(b, -2);
+  bignum_and(a, b, c);
+  BIGNUM_CMP_WITH_INT(c, INT_MIN);
+
+  /* Long operands with carries through every digit. */
+  bignum_assign_int(b, 1);
+  bignum_shl(b, 2000, b);
+  bignum_assign_int(c, 1);
+  bignum_sub(b, c, a);  /* 2^2000 - 1 */
+  bignum_add(a, c, c);
+  bignum_sub(c, b, c);
+  BIGNUM_CMP_WITH_INT(c, 0);
+
+  bignum_assign_int(c, -1);
+  bignum_xor(a, c, c);
+  bignum_add(c, b, c);
+  BIGNUM_CMP_WITH_INT(c, 0);
+
+  bignum_shr(b, 1000, c);
+  bignum_neg(c, c);
+  bignum_and(a, c, c);  /* 2^2000 - 2^1000 - 1 */
+  bignum_sub(b, c, c);
+  bignum_shr(c, 1000, c);
+  BIGNUM_CMP_WITH_INT(c, 1);
+
+  bignum_free(a);
+  bignum_free(b);
+  bignum_free(c);
+}
+
+/* n digits: all ones, random, B^(n-1), or all ones above a zero digit. */
+static void
+fill_pattern(bignum *a, int n, int kind)
+{
+  if (kind == 2) {
+    bignum_assign_int(a, 1);
+    bignum_shl(a, (n - 1) * BIGNUM_SHIFT, a);
+    return;
+  }
+  fill_digits(a, n, n, kind != 1);
+  if (kind == 3) {
+    a->digit[0] = 0;
+  }
+}
+
+/* Add, subtract and bitwise results of a and b, with b and a negated too. */
+static void
+simd_ops(bignum *a, bignum *b, bignum **r)
+{
+  bignum *na = bignum_new();
+  bignum *nb = bignum_new();
+
+  bignum_assign_int(na, 0);
+  bignum_sub(na, a, na);
+  bignum_assign_int(nb, 0);
+  bignum_sub(nb, b, nb);
+
+  bignum_add(a, b, r[0]);
+  bignum_sub(a, b, r[1]);
+  bignum_sub(b, a, r[2]);
+  bignum_and(a, b, r[3]);
+  bignum_and(na, b, r[4]);
+  bignum_or(a, nb, r[5]);
+  bignum_or(na, nb, r[6]);
+  bignum_xor(na, b, r[7]);
+  bignum_neg(a, r[8]);
+
+  bignum_free(na);
+  bignum_free(nb);
+}
+
+void
+bignum_simd_tests()
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+  bignum *ref[9], *res[9];
+  static const int sizes[] = { 15, 16, 17, 31, 32, 33, 64, 65, 100, 257 };
+  static const int masks[] = { BIGNUM_CPU_AVX2, -1 };
+
+  for (int i = 0; i < 9; i++) {
+    ref[i] = bignum_new();
+    res[i] = bignum_new();
+  }
+
+  for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+    for (int ka = 0; ka < 4; ka++) {
+      for (int kb = 0; kb < 4; kb++) {
+        fill_pattern(a, sizes[i], ka);
+        fill_pattern(b, sizes[i] - (kb & 1) * 3, kb);
+
+        bignum_set_cpu_features(0);
+        simd_ops(a, b, ref);
+
+        for (int m = 0; m < 2; m++) {
+          bignum_set_cpu_features(masks[m]);
+          simd_ops(a, b, res);
+          for (int j = 0; j < 9; j++) {
+            bignum_sub(res[j], ref[j], res[j]);
+            BIGNUM_CMP_WITH_INT(res[j], 0);
+          }
+        }
+      }
+    }
+  }
+  bignum_set_cpu_features(-1);
+
+  for (int i = 0; i < 9; i++) {
+    bignum_free(ref[i]);
+    bignum_free(res[i]);
+  }
+  bignum_free(a);
+  bignum_free(b);
+}
+
+/* Products, squares and quotients whose digit loops use mul_1, addmul_1 and submul_1. */
+static void
+adx_ops(bignum *a, bignum *b, bignum *x, bignum **r)
+{
+  bignum_mul(a, b, r[0]);
+  bignum_mul(b, a, r[1]);
+  bignum_sqr(a, r[2]);
+  bignum_mul_ui(a, UINT64_MAX, r[3]);
+  bignum_divmod(x, a, r[4], r[5]);
+}
+
+void
+bignum_adx_tests()
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+  bignum *x = bignum_new();
+  bignum *ref[6], *res[6];
+
+  for (int i = 0; i < 6; i++) {
+    ref[i] = bignum_new();
+    res[i] = bignum_new();
+  }
+
+  /* Lengths that are and are not multiples of the unroll factor of 4. */
+  for (int n = 2; n <= 21; n++) {
+    for (int nb = 1; nb <= 5; nb++) {
+      for (int ones = 0; ones < 2; ones++) {
+        fill_digits(a, n, n, ones);
+        fill_digits(b, nb, nb, ones);
+        fill_digits(x, 2 * n + nb, n + nb, ones);
+
+        bignum_set_cpu_features(~BIGNUM_CPU_ADX);
+        adx_ops(a, b, x, ref);
+        bignum_set_cpu_features(-1);
+        adx_ops(a, b, x, res);
+
+        for (int j = 0; j < 6; j++) {
+          bignum_sub(res[j], ref[j], res[j]);
+          BIGNUM_CMP_WITH_INT(res[j], 0);
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < 6; i++) {
+    bignum_free(ref[i]);
+    bignum_free(res[i]);
+  }
+  bignum_free(a);
+  bignum_free(b);
+  bignum_free(x);
+}
+
+void
+bignum_aliasing_tests()
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+
+  bignum_assign_int(a, 70000);
+  bignum_assign_int(b, -3);
+
+  bignum_add(a, b, a);
+  BIGNUM_CMP_WITH_INT(a, 69997);
+
+  bignum_sub(a, b, b);
+  BIGNUM_CMP_WITH_INT(b, 70000);
+
+  bignum_mul(a, a, a);
+  bignum_div(a, b, a);
+  BIGNUM_CMP_WITH_INT(a, 69994);
+
+  bignum_assign_int(b, -3);
+  bignum_mul(a, b, b);
+  BIGNUM_CMP_WITH_INT(b, -209982);
+
+  bignum_div(b, a, a);
+  BIGNUM_CMP_WITH_INT(a, -3);
+
+  bignum_and(a, b, a);
+  BIGNUM_CMP_WITH_INT(a, -209984);
+
+  bignum_xor(a, a, a);
+  BIGNUM_CMP_WITH_INT(a, 0);
+
+  bignum_free(a);
+  bignum_free(b);
+}
+
+void
+bignum_threads_tests()
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+  bignum *c = bignum_new();
+  bignum *d = bignum_new();
+  static char x[42001];
+
+  /* About 139500 bits, above BIGNUM_MUL_PARALLEL_THRESHOLD for every digit size. */
+  for (int i = 0; i < 42000; i++) {
+    x[i] = '1' + i * 7 % 9;
+  }
+  bignum_assign_str(a, x);
+  bignum_assign_int(b, 1);
+  bignum_sub(a, b, b);
+
+  bignum_mul(a, b, c);
+  bignum_sqr(a, d);
+
+  ASSERT_EQUAL_INT(bignum_set_threads(4), 0);
+  bignum_mul(a, b, b);
+  bignum_sqr(a, a);
+  ASSERT_EQUAL_INT(bignum_set_threads(1), 0);
+
+  bignum_sub(b, c, c);
+  BIGNUM_CMP_WITH_INT(c, 0);
+  bignum_sub(a, d, d);
+  BIGNUM_CMP_WITH_INT(d, 0);
+
+  bignum_free(a);
+  bignum_free(b);
+  bignum_free(c);
+  bignum_free(d);
+}
+
+static int batch_calls = 0;
+static int batch_done = 0;
+
+static void
+batch_progress(void *arg, int done, int n)
+{
+  (void)arg;
+  ASSERT_EQUAL_INT(done, batch_done + 1);
+  ASSERT_EQUAL_INT(n, 24);
+  batch_calls++;
+  batch_done = done;
+}
+
+void
+bignum_batch_tests()
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+  bignum *c[24], *d = bignum_new();
+  bignum_op ops[24];
+
+  bignum_assign_str(a, "-123456789012345678901234567890123456789012345678901234567890");
+  bignum_assign_str(b, "98765432109876543210987");
+
+  for (int i = 0; i < 24; i++) {
+    c[i] = bignum_new();
+    ops[i].op = i % 5;
+    ops[i].a = i % 2 ? a : b;
+    ops[i].b = i % 2 ? b : a;
+    ops[i].c = c[i];
+  }
+  ops[23].op = BIGNUM_OP_MUL;
+  ops[23].a = a;
+  ops[23].b = a;
+
+  ASSERT_EQUAL_INT(bignum_set_threads(3), 0);
+  bignum_batch_run(ops, 24, 0, batch_progress, NULL);
+  ASSERT_EQUAL_INT(bignum_set_threads(1), 0);
+  ASSERT_EQUAL_INT(batch_calls, 24);
+
+  bignum_mul(a, b, d);
+  bignum_sub(c[2], d, d);  /* b * a */
+  BIGNUM_CMP_WITH_INT(d, 0);
+  bignum_div(a, b, d);
+  bignum_sub(c[13], d, d);  /* a / b */
+  BIGNUM_CMP_WITH_INT(d, 0);
+  bignum_mod(b, a, d);
+  bignum_sub(c[4], d, d);  /* b mod a */
+  BIGNUM_CMP_WITH_INT(d, 0);
+  BIGNUM_CMP_WITH_INT(c[8], 0);  /* b / a */
+  bignum_mul(a, a, d);
+  bignum_sub(c[23], d, d);
+  BIGNUM_CMP_WITH_INT(d, 0);
+
+  /* Multiplications large enough to run their own parallel loops inside the
+     batch loop. */
+  fill_digits(a, BIGNUM_MUL_PARALLEL_THRESHOLD + 1, 1, 0);
+  fill_digits(b, BIGNUM_MUL_PARALLEL_THRESHOLD + 3, 2, 1);
+  for (int i = 0; i < 4; i++) {
+    ops[i].op = BIGNUM_OP_MUL;
+    ops[i].a = i % 2 ? a : b;
+    ops[i].b = i < 2 ? a : b;
+    ops[i].c = c[i];
+  }
+  ASSERT_EQUAL_INT(bignum_set_threads(3), 0);
+  bignum_batch_run(ops, 4, 0, NULL, NULL);
+  ASSERT_EQUAL_INT(bignum_set_threads(1), 0);
+  for (int i = 0; i < 4; i++) {
+    bignum_mul(ops[i].a, ops[i].b, d);
+    bignum_sub(c[i], d, d);
+    BIGNUM_CMP_WITH_INT(d, 0);
+  }
+
+  for (int i = 0; i < 24; i++) {
+    bignum_free(c[i]);
+  }
+  bignum_free(a);
+  bignum_free(b);
+  bignum_free(d);
+}
+
+void
+bignum_stats_tests()
+{
+  bignum *a = bignum_new();
+  bignum *b = bignum_new();
+  bignum *c = bignum_new();
+  bignum_stats s;
+
+  bignum_assign_str(a, "123456789012345678901234567890123456789012345678901234567890");
+  bignum_assign_str(b, "98765432109876543210987");
+
+  bignum_stats_reset();
+  bignum_mul(a, b, c);
+  bignum_mul(c, c, c);
+  bignum_div(c, b, c);
+  bignum_stats_get(&s);
+
+#ifdef BIGNUM_STATS
+  ASSERT_EQUAL_INT(s.calls[BIGNUM_STATS_MUL] == 2, 1);
+  ASSERT_EQUAL_INT(s.calls[BIGNUM_STATS_DIV] == 1, 1);
+  ASSERT_EQUAL_INT(s.calls[BIGNUM_STATS_ADD] == 0, 1);
+  ASSERT_EQUAL_INT(s.digits[BIGNUM_STATS_MUL] > 0, 1);
+  ASSERT_EQUAL_INT(s.mul_basecase > 0, 1);
+  ASSERT_EQUAL_INT(s.div_basecase == 1, 1);
+  ASSERT_EQUAL_INT(s.resizes > 0, 1);
+#else
+  ASSERT_EQUAL_INT(s.calls[BIGNUM_STATS_MUL] == 0, 1);
+  ASSERT_EQUAL_INT(s.resizes == 0, 1);
+#endif
+
+  bignum_stats_reset();
+  bignum_stats_get(&s);
+  ASSERT_EQUAL_INT(s.calls[BIGNUM_STATS_MUL] == 0, 1);
+  ASSERT_EQUAL_INT(s.mul_basecase == 0, 1);
+
+#ifdef BIGNUM_STATS
+  /* The pool threads of a parallel multiplication count for the caller. */
+  {
+    bignum_stats t, u, v;
+    bignum d[4];
+    bignum_op ops[4];
+
+    fill_digits(a, BIGNUM_MUL_PARALLEL_THRESHOLD + 5, 41, 0);
+    fill_digits(b, BIGNUM_MUL_PARALLEL_THRESHOLD + 3, 43, 0);
+
+    bignum_stats_reset();
+    bignum_mul(a, b, c);
+    bignum_stats_get(&s);
+    bignum_stats_reset();
+    bignum_sqr(a, c);
+    bignum_stats_get(&u);
+
+    ASSERT_EQUAL_INT(bignum_set_threads(4), 0);
+    bignum_stats_reset();
+    bignum_mul(a, b, c);
+    bignum_stats_get(&t);
+    bignum_stats_reset();
+    bignum_sqr(a, c);
+    bignum_stats_get(&v);
+
+    ASSERT_EQUAL_INT(s.mul_toom3 + s.mul_ntt > 0, 1);
+    ASSERT_EQUAL_INT(t.mul_basecase == s.mul_basecase, 1);
+    ASSERT_EQUAL_INT(t.mul_karatsuba == s.mul_karatsuba, 1);
+    ASSERT_EQUAL_INT(t.mul_toom3 == s.mul_toom3, 1);
+    ASSERT_EQUAL_INT(t.mul_ntt == s.mul_ntt, 1);
+    ASSERT_EQUAL_INT(t.calls[BIGNUM_STATS_MUL] == 1, 1);
+    ASSERT_EQUAL_INT(u.sqr_toom3 + u.mul_ntt > 0, 1);
+    ASSERT_EQUAL_INT(v.sqr_basecase == u.sqr_basecase, 1);
+    ASSERT_EQUAL_INT(v.sqr_karatsuba == u.sqr_karatsuba, 1);
+    ASSERT_EQUAL_INT(v.sqr_toom3 == u.sqr_toom3, 1);
+    ASSERT_EQUAL_INT(v.mul_ntt == u.mul_ntt, 1);
+    ASSERT_EQUAL_INT(v.calls[BIGNUM_STATS_SQR] == 1, 1);
+
+    /* Likewise the operations of a batch run on the pool threads. */
+    for (int i = 0; i < 4; i++) {
+      bignum_init(&d[i]);
+      ops[i].op = BIGNUM_OP_MUL;
+      ops[i].a = a;
+      ops[i].b = b;
+      ops[i].c = &d[i];
+    }
+    bignum_stats_reset();
+    bignum_batch_run(ops, 4, 0, NULL, NULL);
+    bignum_stats_get(&t);
+    ASSERT_EQUAL_INT(t.calls[BIGNUM_STATS_MUL] == 4, 1);
+    ASSERT_EQUAL_INT(t.mul_basecase == 4 * s.mul_basecase, 1);
+    ASSERT_EQUAL_INT(t.mul_toom3 == 4 * s.mul_toom3, 1);
+    ASSERT_EQUAL_INT(t.mul_ntt == 4 * s.mul_ntt, 1);
+    for (int i = 0; i < 4; i++) {
+      bignum_clear(&d[i]);
+    }
+
+    ASSERT_EQUAL_INT(bignum_set_threads(1), 0);
+  }
+#endif
+
+  bignum_free(a);
+  bignum_free(b);
+  bignum_free(c);
+}
+
+static int live_blocks = 0;
+
+static void *
+counting_alloc(size_t n)
+{
+  live_blocks++;
+  return malloc(n);
+}
+
+static void *
+counting_realloc(void *p, size_t n)
+{
+  if (p == NULL) {
+    live_blocks++;
+  }
+  return realloc(p, n);
+}
+
+static void
+counting_free(void *p)
+{
+  live_blocks--;
+  free(p);
+}
+
+void
+bignum_allocator_tests()
+{
+  bignum *a, *b;
+  char *s;
+
+  bignum_set_allocator(counting_alloc, counting_realloc, counting_free);
+
+  a = bignum_new();
+  b = bignum_new();
+  ASSERT_EQUAL_INT(live_blocks, 2);
+
+  bignum_assign_str(a, "-340282366920938463463374607431768211457");
+  bignum_assign_str(b, "18446744073709551617");
+  bignum_div(a, b, a);
+  bignum_mul(a, a, a);
+  s = bignum_to_str(a);
+  ASSERT_EQUAL_INT(strcmp(s, "340282366920938463426481119284349108225"), 0);
+  counting_free(s);
+
+  bignum_free(a);
+  bignum_free(b);
+  bignum_thread_cleanup();
+  ASSERT_EQUAL_INT(live_blocks, 0);
+
+  bignum_set_allocator(NULL, NULL, NULL);
+}
+
+void
+bignum_init_tests()
+{
+  bignum a, b;
+
+  bignum_init(&a);
+  bignum_init(&b);
+  BIGNUM_CMP_WITH_INT(&a, 0);
+  ASSERT_EQUAL_INT(a.digit == a.inline_digit, 1);
+
+  /* Grows out of the inline digits and back. */
+  bignum_assign_int(&a, INT_MIN);
+  bignum_assign_str(&b, "-9903520314283042199192993792");  /* -2^93 */
+  bignum_mul(&b, &b, &b);
+  for (int i = 0; i < 6; i++) {
+    bignum_div(&b, &a, &b);
+  }
+  BIGNUM_CMP_WITH_INT(&b, 1);
+  ASSERT_EQUAL_INT(b.digit == b.inline_digit, 0);
+
+  bignum_clear(&a);
+  bignum_clear(&b);
+  BIGNUM_CMP_WITH_INT(&b, 0);
+  ASSERT_EQUAL_INT(b.digit == b.inline_digit, 1);
+}
+
 int main(void)
 {
   bignum_new_tests();
   bignum_assign_int_tests();
   bignum_assign_str_tests();
+  bignum_to_str_tests();
+  bignum_div_tests();
+  bignum_sqr_tests();
+  bignum_karatsuba_tests();
+  bignum_toom3_tests();
+  bignum_ntt_tests();
+  bignum_bz_tests();
+  bignum_newton_tests();
+  bignum_divmod_tests();
+  bignum_scalar_tests();
+  bignum_shift_tests();
+  bignum_powmod_tests();
+  bignum_barrett_tests();
+  bignum_reserve_tests();
+  bignum_init_tests();
 
   bignum_neg_tests();
+  bignum_bitwise_tests();
+  bignum_simd_tests();
+  bignum_adx_tests();
+  bignum_aliasing_tests();
+  bignum_threads_tests();
+  bignum_batch_tests();
+  bignum_stats_tests();
+  bignum_allocator_tests();
 
   UNIT_STATUS_AND_EXIT;
 